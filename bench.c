@@ -0,0 +1,314 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "histogram.h"
+
+// measures the primitives main is built on and prints the throughput and
+// latency percentiles of each to stdout, to size the unit of time and the
+// quantum on the current machine
+
+#define SYS_MY_GETTIME 333
+#define DEFAULT_ITERATIONS 2000
+// empty samples taken to measure the cost of timing a sample
+#define OVERHEAD_SAMPLES 100000
+
+typedef struct timespec timespec;
+
+typedef struct {
+  const char* name;
+  // runs count operations and records how long each took in nanoseconds;
+  // returns false if the operation is not permitted here
+  bool (*run)(Histogram* histogram, int count);
+  // number of operations per iteration asked for
+  int scale;
+} Benchmark;
+
+// a child that blocks until the parent closes its end of the pipe, used as
+// the target of operations on another process
+typedef struct {
+  pid_t pid;
+  int pipe;
+} Sleeper;
+
+int64_t MonotonicTime();
+int64_t MeasureOverhead(Histogram* histogram);
+void Record(Histogram* histogram, int64_t start);
+void SleeperInit(Sleeper* sleeper);
+void SleeperFree(Sleeper* sleeper);
+bool BenchFork(Histogram* histogram, int count);
+bool BenchReap(Histogram* histogram, int count);
+bool BenchPipe(Histogram* histogram, int count);
+bool BenchSetScheduler(Histogram* histogram, int count);
+bool BenchSetAffinity(Histogram* histogram, int count);
+bool BenchSyscallTime(Histogram* histogram, int count);
+bool BenchClockGettime(Histogram* histogram, int count);
+
+// median time between two consecutive calls to MonotonicTime, which every
+// sample includes once and which is taken off each of them
+int64_t overhead;
+// samples of the current benchmark shorter than overhead, recorded as 0
+int clamped;
+
+const Benchmark benchmarks[] = {
+  { "fork + ready handshake", BenchFork, 1 },
+  { "waitpid reap", BenchReap, 1 },
+  { "pipe wakeup round trip", BenchPipe, 10 },
+  { "sched_setscheduler flip", BenchSetScheduler, 10 },
+  { "sched_setaffinity", BenchSetAffinity, 10 },
+#ifdef KERNEL_TIMING
+  { "syscall 333 gettime", BenchSyscallTime, 100 },
+#else
+  { "clock_gettime syscall", BenchSyscallTime, 100 },
+#endif
+  { "clock_gettime vdso", BenchClockGettime, 100 },
+};
+
+int main(int argc, char** argv) {
+  int iterations = DEFAULT_ITERATIONS;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n':
+        iterations = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (iterations < 1) {
+    fprintf(stderr, "iterations must be positive\n");
+    return 1;
+  }
+
+  Histogram* histogram = malloc(sizeof(Histogram));
+  if (!histogram) abort();
+  overhead = MeasureOverhead(histogram);
+  printf("timing overhead %lld ns, subtracted from every sample\n",
+         (long long)overhead);
+  printf("%-24s %9s %12s %9s %9s %9s %9s %9s\n", "operation (ns)", "count",
+         "ops/s", "mean", "p50", "p90", "p99", "max");
+  for (size_t i = 0; i < sizeof(benchmarks) / sizeof(Benchmark); ++i) {
+    const Benchmark* benchmark = &benchmarks[i];
+    int count = iterations * benchmark->scale;
+    HistogramInit(histogram);
+    clamped = 0;
+    if (!benchmark->run(histogram, count)) {
+      printf("%-24s not permitted: %s\n", benchmark->name, strerror(errno));
+      continue;
+    }
+    // only the time spent in the measured operations counts, not setting
+    // them up; operations cheaper than the resolution leave no time at all
+    printf("%-24s %9d %12.0f %9.0f %9lld %9lld %9lld %9lld\n",
+           benchmark->name, count,
+           histogram->sum > 0 ? count / histogram->sum * 1e9 : 0,
+           HistogramMean(histogram),
+           (long long)HistogramPercentile(histogram, 50),
+           (long long)HistogramPercentile(histogram, 90),
+           (long long)HistogramPercentile(histogram, 99),
+           (long long)histogram->max);
+    if (clamped > 0) {
+      printf("%-24s %9d samples shorter than the timing overhead counted as "
+             "0\n", "", clamped);
+    }
+  }
+  free(histogram);
+}
+
+int64_t MonotonicTime() {
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+int64_t MeasureOverhead(Histogram* histogram) {
+  HistogramInit(histogram);
+  for (int i = 0; i < OVERHEAD_SAMPLES; ++i) {
+    int64_t start = MonotonicTime();
+    HistogramRecord(histogram, MonotonicTime() - start);
+  }
+  return HistogramPercentile(histogram, 50);
+}
+
+void Record(Histogram* histogram, int64_t start) {
+  int64_t sample = MonotonicTime() - start - overhead;
+  if (sample < 0) {
+    sample = 0;
+    ++clamped;
+  }
+  HistogramRecord(histogram, sample);
+}
+
+void SleeperInit(Sleeper* sleeper) {
+  int fds[2];
+  if (pipe(fds) == -1) abort();
+  sleeper->pid = fork();
+  if (sleeper->pid < 0) abort();
+  if (sleeper->pid == 0) {
+    close(fds[1]);
+    char c;
+    while (read(fds[0], &c, 1) > 0);
+    _exit(0);
+  }
+  close(fds[0]);
+  sleeper->pipe = fds[1];
+}
+
+void SleeperFree(Sleeper* sleeper) {
+  close(sleeper->pipe);
+  if (waitpid(sleeper->pid, NULL, 0) < 0) abort();
+}
+
+// from fork until the child has reported through a pipe, as main spawns
+// children
+bool BenchFork(Histogram* histogram, int count) {
+  int fds[2];
+  if (pipe(fds) == -1) abort();
+  for (int i = 0; i < count; ++i) {
+    int64_t start = MonotonicTime();
+    pid_t pid = fork();
+    if (pid < 0) abort();
+    if (pid == 0) {
+      if (write(fds[1], "r", 1) != 1) abort();
+      _exit(0);
+    }
+    char c;
+    if (read(fds[0], &c, 1) != 1) abort();
+    Record(histogram, start);
+    if (waitpid(pid, NULL, 0) < 0) abort();
+  }
+  close(fds[0]);
+  close(fds[1]);
+  return true;
+}
+
+// waitpid on a child that has already exited, so only reaping is timed
+bool BenchReap(Histogram* histogram, int count) {
+  for (int i = 0; i < count; ++i) {
+    pid_t pid = fork();
+    if (pid < 0) abort();
+    if (pid == 0)
+      _exit(0);
+    siginfo_t info;
+    if (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) < 0) abort();
+    int64_t start = MonotonicTime();
+    if (waitpid(pid, NULL, 0) < 0) abort();
+    Record(histogram, start);
+  }
+  return true;
+}
+
+// a byte written to a child blocked in read, which writes it back
+bool BenchPipe(Histogram* histogram, int count) {
+  int request[2];
+  int response[2];
+  if (pipe(request) == -1 || pipe(response) == -1) abort();
+  pid_t pid = fork();
+  if (pid < 0) abort();
+  if (pid == 0) {
+    close(request[1]);
+    close(response[0]);
+    char c;
+    while (read(request[0], &c, 1) == 1)
+      if (write(response[1], &c, 1) != 1) abort();
+    _exit(0);
+  }
+  close(request[0]);
+  close(response[1]);
+  for (int i = 0; i < count; ++i) {
+    int64_t start = MonotonicTime();
+    char c = 'w';
+    if (write(request[1], &c, 1) != 1 || read(response[0], &c, 1) != 1)
+      abort();
+    Record(histogram, start);
+  }
+  close(request[1]);
+  close(response[0]);
+  if (waitpid(pid, NULL, 0) < 0) abort();
+  return true;
+}
+
+// raises and lowers another process between the two highest SCHED_FIFO
+// priorities, as the priority backend of main does
+bool BenchSetScheduler(Histogram* histogram, int count) {
+  Sleeper sleeper;
+  SleeperInit(&sleeper);
+  int maxPriority = sched_get_priority_max(SCHED_FIFO);
+  bool permitted = true;
+  for (int i = 0; i < count && permitted; ++i) {
+    struct sched_param param = { maxPriority - i % 2 };
+    int64_t start = MonotonicTime();
+    permitted = sched_setscheduler(sleeper.pid, SCHED_FIFO, &param) == 0;
+    if (permitted)
+      Record(histogram, start);
+  }
+  int error = errno;
+  SleeperFree(&sleeper);
+  errno = error;
+  return permitted;
+}
+
+// moves another process back and forth between the first and last cpu it
+// may run on
+bool BenchSetAffinity(Histogram* histogram, int count) {
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) abort();
+  int first = -1;
+  int last = -1;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &allowed)) {
+      if (first == -1) first = cpu;
+      last = cpu;
+    }
+  }
+  Sleeper sleeper;
+  SleeperInit(&sleeper);
+  for (int i = 0; i < count; ++i) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(i % 2 ? last : first, &cpus);
+    int64_t start = MonotonicTime();
+    if (sched_setaffinity(sleeper.pid, sizeof(cpus), &cpus) < 0) abort();
+    Record(histogram, start);
+  }
+  SleeperFree(&sleeper);
+  return true;
+}
+
+// a timestamp through a system call: the one in kernel_files when built with
+// TIMING=kernel, otherwise clock_gettime without the vDSO, which enters the
+// kernel the same way
+bool BenchSyscallTime(Histogram* histogram, int count) {
+  for (int i = 0; i < count; ++i) {
+    timespec t;
+    int64_t start = MonotonicTime();
+#ifdef KERNEL_TIMING
+    if (syscall(SYS_MY_GETTIME, &t) < 0) return false;
+#else
+    if (syscall(SYS_clock_gettime, CLOCK_REALTIME, &t) < 0) abort();
+#endif
+    Record(histogram, start);
+  }
+  return true;
+}
+
+bool BenchClockGettime(Histogram* histogram, int count) {
+  for (int i = 0; i < count; ++i) {
+    timespec t;
+    int64_t start = MonotonicTime();
+    clock_gettime(CLOCK_REALTIME, &t);
+    Record(histogram, start);
+  }
+  return true;
+}
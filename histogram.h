@@ -0,0 +1,98 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Log-bucketed histogram of non-negative integers in the style of
+// HdrHistogram. Values below 2^HISTOGRAM_PRECISION_BITS are counted exactly;
+// larger values share a bucket with others that agree in their
+// HISTOGRAM_PRECISION_BITS most significant bits, so every reported value is
+// within 1/2^(HISTOGRAM_PRECISION_BITS - 1) of the recorded one. Memory use
+// is fixed regardless of the number of recorded values.
+
+#define HISTOGRAM_PRECISION_BITS 7
+#define HISTOGRAM_EXACT (1 << HISTOGRAM_PRECISION_BITS)
+#define HISTOGRAM_HALF (HISTOGRAM_EXACT / 2)
+#define HISTOGRAM_BUCKETS (HISTOGRAM_EXACT +                                   \
+                           (63 - HISTOGRAM_PRECISION_BITS) * HISTOGRAM_HALF)
+
+typedef struct {
+  uint64_t counts[HISTOGRAM_BUCKETS];
+  uint64_t count;
+  double sum;
+  int64_t min;
+  int64_t max;
+} Histogram;
+
+static inline void HistogramInit(Histogram* histogram) {
+  memset(histogram, 0, sizeof(Histogram));
+  histogram->min = INT64_MAX;
+}
+
+static inline int HistogramIndex(int64_t value) {
+  if (value < HISTOGRAM_EXACT)
+    return value;
+  int shift = 63 - __builtin_clzll(value) - HISTOGRAM_PRECISION_BITS + 1;
+  return HISTOGRAM_EXACT + (shift - 1) * HISTOGRAM_HALF +
+         (int)(value >> shift) - HISTOGRAM_HALF;
+}
+
+// the middle of the range of values counted in bucket index
+static inline int64_t HistogramValue(int index) {
+  if (index < HISTOGRAM_EXACT)
+    return index;
+  int shift = (index - HISTOGRAM_EXACT) / HISTOGRAM_HALF + 1;
+  int64_t mantissa = (index - HISTOGRAM_EXACT) % HISTOGRAM_HALF +
+                     HISTOGRAM_HALF;
+  return (mantissa << shift) + ((int64_t)1 << (shift - 1));
+}
+
+// negative values are counted as 0
+static inline void HistogramRecord(Histogram* histogram, int64_t value) {
+  if (value < 0) value = 0;
+  ++histogram->counts[HistogramIndex(value)];
+  ++histogram->count;
+  histogram->sum += value;
+  if (value < histogram->min) histogram->min = value;
+  if (value > histogram->max) histogram->max = value;
+}
+
+static inline void HistogramMerge(Histogram* histogram,
+                                  const Histogram* other) {
+  for (int i = 0; i < HISTOGRAM_BUCKETS; ++i)
+    histogram->counts[i] += other->counts[i];
+  histogram->count += other->count;
+  histogram->sum += other->sum;
+  if (other->min < histogram->min) histogram->min = other->min;
+  if (other->max > histogram->max) histogram->max = other->max;
+}
+
+static inline double HistogramMean(const Histogram* histogram) {
+  return histogram->count ? histogram->sum / histogram->count : 0;
+}
+
+// smallest recorded value such that at least percentile percent of the
+// values are less than or equal to it
+static inline int64_t HistogramPercentile(const Histogram* histogram,
+                                          double percentile) {
+  if (histogram->count == 0) return 0;
+  double exactRank = percentile / 100 * histogram->count;
+  uint64_t rank = exactRank;
+  if (rank < exactRank) ++rank;
+  if (rank < 1) rank = 1;
+  if (rank > histogram->count) rank = histogram->count;
+  uint64_t seen = 0;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+    if ((seen += histogram->counts[i]) >= rank) {
+      int64_t value = HistogramValue(i);
+      if (value < histogram->min) return histogram->min;
+      if (value > histogram->max) return histogram->max;
+      return value;
+    }
+  }
+  return histogram->max;
+}
+
+#endif
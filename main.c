@@ -9,7 +9,6 @@
 #include <time.h>
 #include <stdbool.h>
 #include <limits.h>
-#include <alloca.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
@@ -17,6 +16,17 @@
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <linux/futex.h>
+#include "workload.h"
+#include "histogram.h"
+#include "policies.h"
+#include "runqueue.h"
 
 #define SYS_MY_GETTIME 333
 #define SYS_MY_PRINTTIME 334
@@ -30,12 +40,12 @@
                                  for (volatile unsigned long long i = 0;       \
                                       i < 1000000; ++i);                       \
                              }
-#define SET_CPU(cpu) {                                                         \
-                       cpu_set_t cpuSet;                                       \
-                       CPU_ZERO(&cpuSet);                                      \
-                       CPU_SET((cpu), &cpuSet);                                \
-                       sched_setaffinity(0, sizeof(cpuSet), &cpuSet);          \
-                     }
+#define SET_CPU(pid, cpu) {                                                    \
+                            cpu_set_t cpuSet;                                  \
+                            CPU_ZERO(&cpuSet);                                 \
+                            CPU_SET((cpu), &cpuSet);                           \
+                            sched_setaffinity((pid), sizeof(cpuSet), &cpuSet); \
+                          }
 #define SET_PRIORITY(pid, policy, priority) {                                  \
                                               sched_param schedParam;          \
                                               schedParam.sched_priority =      \
@@ -45,83 +55,678 @@
                                                     &schedParam) < 0)          \
                                                 ERROR;                         \
                                             }
-#define START_PROCESS(process) {                                               \
-                                 if (write((process).toChild[1], "s", 1) != 1) \
-                                   ERROR;                                      \
-                               }
-#define QUEUE_INIT(queue, n_) {                                                \
-                               (queue).arr = alloca(sizeof(int) * (n_));       \
-                               (queue).front = (queue).back = (n_);            \
-                               (queue).n_ = (n);                               \
-                             }
-#define QUEUE_PUSH(queue, data) {                                              \
-                                  (queue).arr[(queue).back] = data;            \
-                                  (queue).back = ((queue).back + 1) %          \
-                                                 (queue).n;                    \
-                                }
-#define QUEUE_POP(queue) ({                                                    \
-                            int data = (queue).arr[(queue).front];             \
-                            (queue).front = ((queue).front + 1) % (queue).n;   \
-                            data;                                              \
-                         })
-#define QUEUE_FRONT(queue) ((queue).arr[(queue).front])
-
+#define PICK_PROCESS(process) Pick(&(process))
+#define START_PROCESS(process) Start(&(process))
 typedef struct {
   char name[32];
   int readyTime;
   int execTime;
+  // absolute time by which the process should finish, WORKLOAD_NO_DEADLINE
+  // if none
+  int deadline;
+  int weight;
   int index;
-  int fromChild[2];
-  int toChild[2];
+  struct Shared* shared;
   pid_t pid;
+  // cpu the child is allowed to run on
+  int cpu;
   bool started;
   bool finished;
+  // the child has exited and been reaped, which may be before the simulation
+  // finishes it
+  bool exited;
+  // units of work the child reported that the parent has accounted for
+  int progress;
 } Process;
 
+#define DEFAULT_QUANTUM 500
+#define DEFAULT_WINDOW 64
+
+// how a waiting child is told to start
+typedef enum {
+  // SIGUSR1, waited for with sigwait
+  GATE_SIGNAL,
+  // a futex word in memory shared with the parent
+  GATE_FUTEX,
+} Gate;
+
+// how the parent waits for simulated time to pass
+typedef enum {
+  // TIMEKEEPING_SLEEP if the length of a unit of time is calibrated for the
+  // children to work by (-u) or for the deadline backend, and
+  // TIMEKEEPING_SPIN otherwise, as there is then no length to sleep for
+  TIMEKEEPING_AUTO,
+  // runs UNITS_OF_TIME itself, checking for exited children after every unit
+  TIMEKEEPING_SPIN,
+  // sleeps until absolute deadlines computed from the calibrated length of a
+  // unit of time
+  TIMEKEEPING_SLEEP,
+} Timekeeping;
+
+// how the parent makes the child chosen by the policy run in place of the
+// others on its cpu
+typedef enum {
+  // the chosen child runs at a higher SCHED_FIFO priority than the others
+  // and keeps running until the parent lowers it again
+  BACKEND_PRIORITY,
+  // the chosen child runs with SCHED_DEADLINE and a budget of its time
+  // slice, so the kernel stops it once the slice is used up even if the
+  // parent is late; the children may run on every cpu, so the others are
+  // stopped with SIGSTOP rather than left below it
+  BACKEND_DEADLINE,
+  // children are stopped with SIGSTOP and resumed with SIGCONT
+  BACKEND_SIGNAL,
+  // children check a flag in shared memory as they work and block on it
+  // while it is cleared, so suspending one takes no system call but only
+  // takes effect at its next check
+  BACKEND_YIELD,
+} Backend;
+
+// the parent runs on PARENT_CPU, where no child may run
+#define PARENT_CPU 0
+#define DEFAULT_CHILD_CPU 1
+#define DEFAULT_CALIBRATION_UNITS 20
+// iterations of the work kernel between checks of the cpu time
+#define WORK_CHUNK 4096
+// A SCHED_DEADLINE child gets its time slice, plus DEADLINE_HEADROOM percent
+// for the work it does around its last slice before it exits, as runtime
+// with a deadline and period long enough that its bandwidth is kept low: the
+// kernel keeps counting the bandwidth of a preempted child until its
+// deadline and refuses to admit more than 95% in total by default. A child
+// that still uses up its runtime is throttled until the end of the period.
+#define DEADLINE_BANDWIDTH 10
+#define DEADLINE_HEADROOM 25
+#define DEADLINE_MIN_RUNTIME 100000
+// longer slices would need a period beyond the kernel's limit of about 4s,
+// and run with SCHED_FIFO as with BACKEND_PRIORITY instead, as do slices
+// for which the kernel refuses the bandwidth or the policy
+#define DEADLINE_MAX_RUNTIME 400000000
+
+typedef struct {
+  // length of a round robin time slice
+  int quantum;
+  // CFS target latency and minimum granularity
+  int targetLatency;
+  int minGranularity;
+  // number of MLFQ levels and their quanta, 0 for the default
+  int levels;
+  int levelQuanta[MLFQ_MAX_LEVELS];
+  int boostPeriod;
+  // EDF admission control
+  bool admission;
+  // seed of the lottery, 0 for the default
+  uint64_t seed;
+  // report the statistics kept by the policy
+  bool reportPolicy;
+  // maximum number of children spawned ahead of being started
+  int window;
+  Gate gate;
+  // report the latency between picking a process and it starting to run,
+  // and how long preempted processes ran compared to their time slice
+  bool reportDispatch;
+  Backend backend;
+  // decide when the running process has used up its time slice or finished
+  // by the progress children report instead of the time that passed
+  bool closedLoop;
+  Timekeeping timekeeping;
+  // report how far events happen from their scheduled time
+  bool reportDrift;
+  // units of time run to calibrate the length of a unit of time
+  int calibrationUnits;
+  // length of a unit of time in nanoseconds: 0 if a unit is a fixed number
+  // of iterations of UNITS_OF_TIME, negative to calibrate it at startup
+  double nsPerUnit;
+  // cpus children run on in multi-cpu mode, NULL to run every child on
+  // DEFAULT_CHILD_CPU with the single-cpu policies
+  int* cpus;
+  int cpuCount;
+} Options;
+
+// per-process state in a mapping shared with all children
+typedef struct Shared {
+  // set to 1 to start the child when using GATE_FUTEX
+  uint32_t gate;
+  // cleared to make the child block at its next check with BACKEND_YIELD
+  uint32_t run;
+  // CLOCK_MONOTONIC in nanoseconds when the child noticed it was resumed
+  // with BACKEND_SIGNAL or BACKEND_YIELD, 0 until then
+  int64_t resumeTime;
+  // CLOCK_MONOTONIC in nanoseconds when the parent picked the process to run
+  // for the first time, and when the child started running
+  int64_t pickTime;
+  int64_t startTime;
+  // units of work the child has completed
+  int32_t progress;
+} Shared;
+
+// Children are forked lazily: at most window of them are kept waiting ahead
+// of time, in order of ready time, and any other process is forked when it
+// is first dispatched. A child reports that it has been forked through one
+// pipe shared by all children, and is started with SIGUSR1, which every
+// process keeps blocked so that it stays pending until the child waits for
+// it.
 typedef struct {
-  int* arr;
-  int front;
-  int back;
+  Process* processes;
   int n;
-} Queue;
+  // processes before next have all been spawned
+  int next;
+  // number of spawned processes that have not been started
+  int idle;
+  int window;
+  Gate gate;
+  // cpu children are moved to once they report, -1 to let them run on
+  // every cpu in span
+  int childCpu;
+  // the cpus given with -C, or every cpu but PARENT_CPU, which the kernel
+  // narrows down to those of the cpuset
+  cpu_set_t span;
+  Shared* shared;
+  // children forked by the last call to Spawn or SpawnAhead
+  Process** forked;
+  int readyPipe[2];
+  sigset_t startSignal;
+  // in a child, its own shared state, to which it reports its progress
+  Shared* self;
+  // in a child with BACKEND_YIELD, its own shared state, NULL otherwise
+  Shared* yielding;
+} Spawner;
+
+typedef struct {
+  int cpu;
+  RunQueue queue;
+  // process running on the cpu, -1 if none
+  int running;
+  // process that was running before the last event and was put back into
+  // the queue, -1 if none
+  int previous;
+  // when the current round robin time slice ends
+  int sliceEnd;
+} Worker;
 
 typedef struct sched_param sched_param;
 typedef struct timespec timespec;
 
+// struct sched_attr of sched_setattr, which glibc does not wrap
+typedef struct {
+  uint32_t size;
+  uint32_t policy;
+  uint64_t flags;
+  int32_t nice;
+  uint32_t priority;
+  uint64_t runtime;
+  uint64_t deadline;
+  uint64_t period;
+} SchedAttr;
+
+// A way for the parent to switch children in and out of the cpu. Every
+// system call it makes is counted in the dispatcher.
+typedef struct {
+  const char* name;
+  // called in a child before it waits to be started, may be NULL
+  void (*child)(Shared* shared);
+  // lets the process run in place of any other child for units of time
+  void (*resume)(Process* process, int units);
+  // stops a preempted process from running until it is resumed
+  void (*suspend)(Process* process);
+  // resume has to be repeated even if the same process goes on running
+  bool renew;
+  // children may run with a real-time policy, above which the parent has
+  // to run to keep control of the cpu
+  bool realtime;
+} DispatchBackend;
+
+// Switches children in and out of the cpu for the single-cpu policies.
+typedef struct {
+  const DispatchBackend* backend;
+  int maxPriority;
+  long long switches;
+  long long syscalls;
+  // parent time spent on each switch, and time from the start of a switch
+  // until the resumed child noticed, in nanoseconds
+  Histogram* cost;
+  Histogram* wakeLatency;
+  // when the switch to the running process started, and whether it had run
+  // before
+  int64_t switchStart;
+  bool resumed;
+  // cpu time a preempted child got since it was dispatched minus the
+  // simulated time it was meant to run, in nanoseconds
+  Histogram* overrun;
+  double overrunSum;
+  int64_t maxOverrun;
+  int64_t maxUnderrun;
+  // number of SCHED_DEADLINE budgets the kernel refused for lack of
+  // bandwidth, of those it did not permit at all and of those longer than
+  // DEADLINE_MAX_RUNTIME, for which the child ran with SCHED_FIFO instead
+  int refused;
+  int denied;
+  int tooLong;
+  // units of time the running process was assumed to work and units it
+  // reported, and their absolute difference between consecutive events
+  long long assumedProgress;
+  long long actualProgress;
+  Histogram* progressError;
+} Dispatcher;
+
+// Lets the parent wait for whichever comes first of the next timed event and
+// the exit of any child: a timerfd armed for the deadline of the next event in
+// TIMEKEEPING_SLEEP mode and a signalfd for SIGCHLD are watched with one epoll
+// instance. Children that exited are reaped with waitid and found by pid in
+// an open-addressing table, so the parent holds the same few descriptors
+// however many children are alive.
+typedef struct {
+  int epoll;
+  int timer;
+  int childSignal;
+  // every child that has been forked, by pid; a power of two at least twice
+  // the number of processes
+  Process** children;
+  int capacity;
+} EventLoop;
+
+// events returned by WaitEvents
+#define EVENT_TIMER (1 << 0)
+#define EVENT_EXIT (1 << 1)
+#define EVENT_BATCH 16
+// epoll data of the signalfd; the timerfd has NULL
+#define EVENT_CHILD ((void*)&events.childSignal)
+
+// Tracks the simulated time of the parent. Time 0 is when the policy
+// starts; in TIMEKEEPING_SLEEP mode (or when drift is reported) simulated
+// time t corresponds to epoch + t * nsPerUnit on CLOCK_MONOTONIC.
+typedef struct {
+  Timekeeping mode;
+  int currentTime;
+  bool calibrated;
+  // run units of time for a budget of cpu time instead of a fixed number of
+  // iterations
+  bool timedWork;
+  double nsPerUnit;
+  int64_t epoch;
+  // absolute difference between when events happen and when they are
+  // scheduled, in nanoseconds
+  Histogram* drift;
+  double driftSum;
+  int64_t maxLate;
+  int64_t maxEarly;
+} Timekeeper;
+
+// operations of the parent whose overhead is traced
+typedef enum {
+  // lowering a preempted child, or stopping it, by the dispatch backend
+  TRACE_SUSPEND,
+  // letting a child run by the dispatch backend
+  TRACE_RESUME,
+  // moving a child to another cpu in multi-cpu mode
+  TRACE_MIGRATE,
+  // forking children and waiting for them to report
+  TRACE_SPAWN,
+  // opening the gate of a child, START_PROCESS
+  TRACE_START,
+  // waitpid on a child that has exited
+  TRACE_REAP,
+  // decisions of the policy
+  TRACE_ARRIVAL,
+  TRACE_EVENT,
+  TRACE_PICK,
+  TRACE_PREEMPT,
+  TRACE_FINISH,
+  TRACE_TYPES,
+} TraceType;
+
+#define TRACE_MAGIC "SCHEDTR"
+#define TRACE_VERSION 1
+#define TRACE_INITIAL_CAPACITY 4096
+
+// The trace file holds, in host byte order:
+//   TraceHeader
+//   TraceRecord[count], in the order the operations finished
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t typeCount;
+  uint64_t count;
+} TraceHeader;
+
+typedef struct {
+  // CLOCK_MONOTONIC in nanoseconds when the operation started, and how long
+  // it took
+  int64_t start;
+  int64_t duration;
+  int32_t type;
+  // index of the process in the input, -1 if the operation is not about one
+  int32_t process;
+} TraceRecord;
+
+// Records the operations of the parent in memory while it schedules, so
+// that tracing costs no more than two clock reads per operation, and writes
+// them to a file once every child has finished.
+typedef struct {
+  // NULL unless tracing
+  TraceRecord* records;
+  size_t count;
+  size_t capacity;
+  const char* path;
+} Tracer;
+
+#define TIMING_RING_SIZE 4096
+
+// what PrintTime records for one process
+typedef struct {
+  // position of the record in the ring plus one once it has been written
+  uint64_t sequence;
+  pid_t pid;
+  long startSec;
+  long startNSec;
+  long finishSec;
+  long finishNSec;
+} TimingRecord;
+
+// Lock-free ring in memory shared with all children, into which children
+// write their timing records and from which the parent copies them to the
+// result file. A child waits if the ring is full; the parent drains it every
+// time it picks a process to run.
+typedef struct {
+  // next position to be written by a child
+  uint64_t head;
+  // next position to be read by the parent
+  uint64_t tail;
+  TimingRecord records[TIMING_RING_SIZE];
+} TimingRing;
+
+Spawner spawner;
+Timekeeper timekeeper;
+Dispatcher dispatcher;
+EventLoop events;
+Tracer tracer;
+#ifndef KERNEL_TIMING
+TimingRing* timingRing;
+FILE* timingFile;
+#endif
+
 void GetTime(timespec* t);
+int ProcessCmp(const void* pa, const void* pb);
 void PrintTime(pid_t pid, long startSec, long startNSec, long finishSec,
                long finishNSec);
-int ProcessCmp(const void* pa, const void* pb);
-void PolicyFIFO(Process* processes, int n);
-void PolicyRR(Process* processes, int n);
-void PolicySJF(Process* processes, int n);
-void PolicyPSJF(Process* processes, int n);
+void RunPolicy(const Policy* policy, Process* processes, int n,
+               const Options* options);
+void PolicyMultiCPU(Process* processes, int n,
+                    const RunQueueDiscipline* discipline,
+                    const Options* options);
+bool ParseCpus(const char* list, int** cpus, int* count);
 pid_t ProcessInit(Process* process);
+void SpawnerInit(Process* processes, int n, const Options* options);
+void Spawn(Process* process);
+void SpawnAhead();
+void SpawnWait(int forked);
+void Pick(Process* process);
+void Start(Process* process);
+int64_t MonotonicTime();
+void DispatcherInit(const Options* options);
+void Switch(Process* previous, Process* next, int units);
+void Woke(const Process* process);
+void Finished(Process* process);
+void PriorityResume(Process* process, int units);
+void PrioritySuspend(Process* process);
+void DeadlineResume(Process* process, int units);
+void SignalResume(Process* process, int units);
+void SignalSuspend(Process* process);
+void YieldResume(Process* process, int units);
+void YieldSuspend(Process* process);
+void YieldPoint(Shared* shared);
+void SignalChild(Shared* shared);
+void ContinueHandler(int signal);
+void YieldChild(Shared* shared);
+void Overran(int64_t overrun);
+int Progressed(Process* process, int assumed);
+int64_t ChildCpuTime(pid_t pid);
+void TimekeeperInit(const Options* options);
+void TimekeeperStart();
+void EventLoopInit(int n);
+void Watch(Process* process);
+Process** WatchedSlot(pid_t pid);
+int WaitEvents(int timeout);
+void WaitExit(Process* process);
+int WaitUntil(int time);
+void Reached(int time);
+void ReportDrift();
+void TimingInit(const char* path);
+void TimingDrain();
+void TimingClose();
+void TraceInit(const char* path);
+int64_t TraceBegin();
+void TraceEnd(TraceType type, const Process* process, int64_t start);
+void TraceClose();
+void Work(int units);
+int64_t CpuTime();
+void ReportDispatch(const Process* processes, int n, const Options* options);
+void ReportProgress(const Options* options);
+
+// indexed by Backend
+const DispatchBackend backends[] = {
+  { "priority", NULL, PriorityResume, PrioritySuspend, false, true },
+  { "deadline", SignalChild, DeadlineResume, SignalSuspend, true, true },
+  { "signal", SignalChild, SignalResume, SignalSuspend, false, false },
+  { "yield", YieldChild, YieldResume, YieldSuspend, false, false },
+};
 
-int main() {
+// indexed by TraceType
+const char* traceNames[] = {
+  "suspend", "resume", "migrate", "spawn", "start", "reap", "arrival",
+  "event", "pick", "preempt", "finish",
+};
+
+int main(int argc, char** argv) {
 #ifdef DEBUG
   setvbuf(stdout, NULL, _IONBF, 0);
 #endif
 
-  SET_CPU(0);
+  Options options = { DEFAULT_QUANTUM, DEFAULT_TARGET_LATENCY,
+                      DEFAULT_MIN_GRANULARITY, 0, { 0 }, DEFAULT_BOOST_PERIOD,
+                      false, 0, false, DEFAULT_WINDOW, GATE_SIGNAL, false,
+                      BACKEND_PRIORITY, false, TIMEKEEPING_AUTO, false,
+                      DEFAULT_CALIBRATION_UNITS, 0 };
+  const char* timingPath = NULL;
+  const char* tracePath = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "aB:b:C:c:deG:g:L:M:o:P:pq:rS:T:t:u:w:")) !=
+         -1) {
+    switch (opt) {
+      case 'a':
+        options.admission = true;
+        break;
+      case 'B':
+        options.boostPeriod = atoi(optarg);
+        break;
+      case 'b':
+        if (strcmp(optarg, "priority") == 0) {
+          options.backend = BACKEND_PRIORITY;
+        } else if (strcmp(optarg, "deadline") == 0) {
+          options.backend = BACKEND_DEADLINE;
+        } else if (strcmp(optarg, "signal") == 0) {
+          options.backend = BACKEND_SIGNAL;
+        } else if (strcmp(optarg, "yield") == 0) {
+          options.backend = BACKEND_YIELD;
+        } else {
+          fprintf(stderr, "unknown backend %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 'C':
+        if (!ParseCpus(optarg, &options.cpus, &options.cpuCount)) {
+          fprintf(stderr, "%s: invalid list of cpus, which must not repeat "
+                          "a cpu or include cpu %d\n", optarg, PARENT_CPU);
+          return 1;
+        }
+        break;
+      case 'o':
+#ifdef KERNEL_TIMING
+        // results go to the kernel log, which has no file to redirect
+        fprintf(stderr, "-o is not supported when timing in the kernel\n");
+        return 1;
+#else
+        timingPath = optarg;
+        break;
+#endif
+      case 'T':
+        tracePath = optarg;
+        break;
+      case 'u':
+        if (strcmp(optarg, "auto") == 0) {
+          options.nsPerUnit = -1;
+        } else if ((options.nsPerUnit = atof(optarg)) <= 0) {
+          fprintf(stderr, "unit must be auto or a positive length in ns\n");
+          return 1;
+        }
+        break;
+      case 'c':
+        options.calibrationUnits = atoi(optarg);
+        break;
+      case 'e':
+        options.reportDrift = true;
+        break;
+      case 't':
+        if (strcmp(optarg, "auto") == 0) {
+          options.timekeeping = TIMEKEEPING_AUTO;
+        } else if (strcmp(optarg, "spin") == 0) {
+          options.timekeeping = TIMEKEEPING_SPIN;
+        } else if (strcmp(optarg, "sleep") == 0) {
+          options.timekeeping = TIMEKEEPING_SLEEP;
+        } else {
+          fprintf(stderr, "unknown timekeeping %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 'd':
+        options.reportDispatch = true;
+        break;
+      case 'g':
+        if (strcmp(optarg, "signal") == 0) {
+          options.gate = GATE_SIGNAL;
+        } else if (strcmp(optarg, "futex") == 0) {
+          options.gate = GATE_FUTEX;
+        } else {
+          fprintf(stderr, "unknown gate %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 'G':
+        options.minGranularity = atoi(optarg);
+        break;
+      case 'L':
+        options.targetLatency = atoi(optarg);
+        break;
+      case 'M':
+        if (!MLFQParseQuanta(optarg, options.levelQuanta, &options.levels)) {
+          fprintf(stderr, "%s: invalid list of quanta\n", optarg);
+          return 1;
+        }
+        break;
+      case 'P':
+        if (!PolicyLoad(optarg))
+          return 1;
+        break;
+      case 'p':
+        options.closedLoop = true;
+        break;
+      case 'r':
+        options.reportPolicy = true;
+        break;
+      case 'S':
+        options.seed = strtoull(optarg, NULL, 0);
+        break;
+      case 'q':
+        options.quantum = atoi(optarg);
+        break;
+      case 'w':
+        options.window = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-d] [-e] [-g signal|futex] "
+                        "[-b priority|deadline|signal|yield] [-p] "
+                        "[-q quantum] "
+                        "[-t auto|spin|sleep] [-c calibration units] "
+                        "[-u auto|ns per unit] [-o timing file] "
+                        "[-T trace file] "
+                        "[-w window] [-C cpus] [-P policy plugin] "
+                        "[-L target latency] [-G minimum granularity] "
+                        "[-M level quanta] [-B boost period] [-a] [-r] "
+                        "[-S lottery seed]\n",
+                argv[0]);
+        return 1;
+    }
+  }
+  if (options.quantum < 1 || options.targetLatency < 1 ||
+      options.minGranularity < 1 || options.boostPeriod < 1) {
+    fprintf(stderr, "quantum, target latency, granularity and boost period "
+                    "must be positive\n");
+    return 1;
+  }
+  if (options.window < 0) options.window = 0;
+  if (options.calibrationUnits < 1) options.calibrationUnits = 1;
 
-  char policy[8];
-  if (scanf("%8s", policy) != 1) ERROR;
-  
-  int n;
-  if (scanf("%d", &n) != 1) ERROR;
+  SET_CPU(0, PARENT_CPU);
+
+  Reader reader;
+  if (!ReaderOpen(&reader, STDIN_FILENO)) ERROR;
+
+  Workload workload;
+  if (!WorkloadOpen(&reader, &workload)) {
+    fprintf(stderr, "%s\n", workload.error);
+    return 1;
+  }
+  const char* policy = workload.policy;
+  int n = workload.count;
   Process* processes = calloc(n, sizeof(Process));
   if (!processes) ERROR;
   for (int i = 0; i < n; ++i) {
-    if (scanf("%s%d%d", processes[i].name, &processes[i].readyTime,
-                        &processes[i].execTime) != 3) ERROR;
-    processes[i].index = i;
-    if (pipe(processes[i].fromChild) == -1) ERROR;
-    if (pipe(processes[i].toChild) == -1) ERROR;
-    processes[i].pid = ProcessInit(&processes[i]);
+    WorkloadJob job;
+    if (!WorkloadNext(&workload, &job)) {
+      fprintf(stderr, "%s %d\n", workload.error, i + 1);
+      return 1;
+    }
+    memcpy(processes[i].name, job.name, sizeof(processes[i].name));
+    processes[i].readyTime = job.readyTime;
+    processes[i].execTime = job.execTime;
+    processes[i].deadline = job.deadline;
+    processes[i].weight = job.weight;
+    processes[i].index = job.index;
   }
+  ReaderClose(&reader);
+  if (!workload.binary)
+    qsort(processes, n, sizeof(Process), ProcessCmp);
 
-  qsort(processes, n, sizeof(Process), ProcessCmp);
+  const Policy* schedPolicy = PolicyFind(policy);
+  if (!schedPolicy) {
+    fprintf(stderr, "%s: unknown policy\n", policy);
+    return 1;
+  }
+  const RunQueueDiscipline* discipline = NULL;
+  if (options.cpus && !(discipline = RunQueueDisciplineFind(policy))) {
+    fprintf(stderr, "%s: not supported with more than one cpu\n", policy);
+    return 1;
+  }
+  if (options.cpus && options.backend != BACKEND_PRIORITY) {
+    fprintf(stderr, "only the priority backend supports more than one cpu\n");
+    return 1;
+  }
+  if (options.cpus && options.closedLoop) {
+    fprintf(stderr, "closed-loop progress is not supported with more than "
+                    "one cpu\n");
+    return 1;
+  }
+
+  TimekeeperInit(&options);
+  DispatcherInit(&options);
+  EventLoopInit(n);
+  TimingInit(timingPath);
+  TraceInit(tracePath);
+  if (timekeeper.timedWork) {
+    printf("unit %.0f\n", timekeeper.nsPerUnit);
+    // children would inherit anything still buffered
+    fflush(stdout);
+  }
+  SpawnerInit(processes, n, &options);
   
 #ifdef DEBUG
   printf("input:\n%s\n%d\n", policy, n);
@@ -132,19 +737,10 @@ int main() {
   printf("\n");
 #endif
 
-  for (int i = 0; i < n; ++i) {
-    char c;
-    if (read(processes[i].fromChild[0], &c, 1) != 1) ERROR;
-  }
-
-  if (strcmp(policy, "FIFO") == 0)
-    PolicyFIFO(processes, n);
-  else if (strcmp(policy, "RR") == 0)
-    PolicyRR(processes, n);
-  else if (strcmp(policy, "SJF") == 0)
-    PolicySJF(processes, n);
-  else if (strcmp(policy, "PSJF") == 0)
-    PolicyPSJF(processes, n);
+  if (options.cpus)
+    PolicyMultiCPU(processes, n, discipline, &options);
+  else
+    RunPolicy(schedPolicy, processes, n, &options);
 
 #ifdef DEBUG
   printf("spawned all processes, waiting\n");
@@ -158,201 +754,450 @@ int main() {
       ERROR;
     }
   }
+
+  TimingClose();
+  TraceClose();
+  ReportProgress(&options);
+  if (options.reportDispatch)
+    ReportDispatch(processes, n, &options);
+  if (options.reportDrift)
+    ReportDrift();
 }
 
+#ifdef KERNEL_TIMING
 void GetTime(timespec* t) {
-  syscall(333, t);
+  syscall(SYS_MY_GETTIME, t);
 }
 
 void PrintTime(pid_t pid, long startSec, long startNSec, long finishSec,
                long finishNSec) {
-  syscall(334, pid, startSec, startNSec, finishSec, finishNSec);
+  syscall(SYS_MY_PRINTTIME, pid, startSec, startNSec, finishSec, finishNSec);
+}
+
+void TimingInit(const char* path) {}
+void TimingDrain() {}
+void TimingClose() {}
+#else
+void GetTime(timespec* t) {
+  clock_gettime(CLOCK_REALTIME, t);
 }
 
+void PrintTime(pid_t pid, long startSec, long startNSec, long finishSec,
+               long finishNSec) {
+  uint64_t position = __atomic_fetch_add(&timingRing->head, 1,
+                                         __ATOMIC_RELAXED);
+  while (position - __atomic_load_n(&timingRing->tail, __ATOMIC_ACQUIRE) >=
+         TIMING_RING_SIZE)
+    sched_yield();
+  TimingRecord* record = &timingRing->records[position % TIMING_RING_SIZE];
+  record->pid = pid;
+  record->startSec = startSec;
+  record->startNSec = startNSec;
+  record->finishSec = finishSec;
+  record->finishNSec = finishNSec;
+  __atomic_store_n(&record->sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+// results are written in the same format as the kernel's PrintTime writes
+// them to the kernel log, to stderr if path is NULL
+void TimingInit(const char* path) {
+  timingRing = mmap(NULL, sizeof(TimingRing), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (timingRing == MAP_FAILED) ERROR;
+  timingFile = path ? fopen(path, "w") : stderr;
+  if (!timingFile) ERROR;
+}
+
+void TimingDrain() {
+  uint64_t tail = timingRing->tail;
+  for (TimingRecord* record;
+       __atomic_load_n(&(record = &timingRing->records[tail %
+                                                       TIMING_RING_SIZE])
+                         ->sequence, __ATOMIC_ACQUIRE) == tail + 1; ++tail) {
+    fprintf(timingFile, "[Project1] %d %ld.%09ld %ld.%09ld\n", record->pid,
+            record->startSec, record->startNSec, record->finishSec,
+            record->finishNSec);
+    __atomic_store_n(&timingRing->tail, tail + 1, __ATOMIC_RELEASE);
+  }
+}
+
+void TimingClose() {
+  TimingDrain();
+  if (timingFile != stderr && fclose(timingFile) != 0) ERROR;
+}
+#endif
+
 int ProcessCmp(const void* pa, const void* pb) {
   const Process* a = pa;
   const Process* b = pb;
-  if (a->readyTime == b->readyTime)
-    return a->index - b->index;
-  return a->readyTime - b->readyTime;
+  return WorkloadOrder(a->readyTime, a->index, b->readyTime, b->index);
 }
 
-void PolicyFIFO(Process* processes, int n) {
-  int maxPriority = sched_get_priority_max(SCHED_FIFO);
-  SET_PRIORITY(0, SCHED_FIFO, maxPriority);
-  UNITS_OF_TIME(processes[0].readyTime);
-  for (int i = 0; i < n; ++i) {
-    SET_PRIORITY(processes[i].pid, SCHED_FIFO, maxPriority);
-    START_PROCESS(processes[i]);
-    if (waitpid(processes[i].pid, NULL, 0) < 0) ERROR;
-  }
-}
+// Runs the policy with the parent following its simulated time: at every
+// event the parent waits for the running child if it completes first, and
+// otherwise sleeps or spins until the next arrival or the end of the time
+// slice. The chosen child is resumed through the dispatcher, and a preempted
+// child is suspended until it is chosen again.
+void RunPolicy(const Policy* policy, Process* processes, int n,
+               const Options* options) {
+  if (dispatcher.backend->realtime)
+    SET_PRIORITY(0, SCHED_FIFO, dispatcher.maxPriority);
+  TimekeeperStart();
+  PolicyJob* jobs = calloc(n, sizeof(PolicyJob));
+  if (!jobs) ERROR;
+  POLICY_JOBS_INIT(jobs, processes, n);
+  PolicyParams params = { options->quantum, options->targetLatency,
+                          options->minGranularity, options->levels,
+                          options->levelQuanta, options->boostPeriod,
+                          options->admission, options->seed };
+  void* state = policy->create(jobs, n, &params);
 
-void PolicyRR(Process* processes, int n) {
-  int maxPriority = sched_get_priority_max(SCHED_RR);
-  SET_PRIORITY(0, SCHED_RR, maxPriority);
-  UNITS_OF_TIME(processes[0].readyTime);
   int currentTime = processes[0].readyTime;
-  int prevExecIndex = -1;
-  int prevExecTime;
-  Queue queue;
-  QUEUE_INIT(queue, n);
-  for (int i = 0, remainingProcesses = n; true;) {
+  WaitUntil(currentTime);
+  int execIndex = -1;
+  int sliceEnd = INT_MAX;
+  // when the running process was dispatched, and its cpu time then if
+  // overruns are measured
+  int dispatchTime = 0;
+  int64_t dispatchCpuTime = 0;
+  bool measure = options->reportDispatch && timekeeper.calibrated;
+  for (int i = 0, finishedProcesses = 0; finishedProcesses < n;) {
     bool preempted = false;
-    if (prevExecIndex != -1) {
-      if (prevExecTime <= 500) {
-  #ifdef DEBUG
-        //printf("waiting for P%d to finish\n", prevExecIndex + 1);
-  #endif
-        if (waitpid(processes[prevExecIndex].pid, NULL, 0) < 0) ERROR;
-        currentTime += prevExecTime;
-        if (--remainingProcesses == 0)
-          break;
-        preempted = false;
-      } else {
-  #ifdef DEBUG
-        //printf("executing 500 time units for P%d (execTime = %d)\n",
-               //prevExecIndex + 1, prevExecTime);
-  #endif
-        UNITS_OF_TIME(500);
-        currentTime += 500;
-        processes[prevExecIndex].execTime -= 500;
-        preempted = true;
-      }
+    for (; i < n && processes[i].readyTime <= currentTime; ++i) {
+      int64_t start = TraceBegin();
+      preempted |= policy->onArrival(state, i, currentTime);
+      TraceEnd(TRACE_ARRIVAL, &processes[i], start);
     }
-    for (; i < n && processes[i].readyTime <= currentTime; ++i)
-      QUEUE_PUSH(queue, i);
-    if (preempted)
-      QUEUE_PUSH(queue, prevExecIndex);
-    int execIndex = QUEUE_POP(queue);
-#ifdef DEBUG
-    //printf("current time %d, chosen P%d\n", currentTime, execIndex + 1);
-#endif
-    if (execIndex != prevExecIndex) {
-      if (preempted) {
-#ifdef DEBUG
-        printf("%d: P%d preempted (%d), P%d chosen (%d)\n", currentTime,
-               prevExecIndex + 1, processes[prevExecIndex].execTime,
-               execIndex + 1, processes[execIndex].execTime);
-#endif
-        SET_PRIORITY(processes[prevExecIndex].pid, SCHED_RR, maxPriority - 1);
-      }
-#ifdef DEBUG
-      else {
-        printf("%d: P%d finished, P%d chosen (%d)\n", currentTime,
-               prevExecIndex + 1, execIndex + 1, processes[execIndex].execTime);
+    if (policy->onEvent) {
+      int64_t start = TraceBegin();
+      policy->onEvent(state, currentTime);
+      TraceEnd(TRACE_EVENT, NULL, start);
+    }
+    int prevExecIndex = -1;
+    if (execIndex != -1 && (preempted || currentTime == sliceEnd)) {
+      int64_t start = TraceBegin();
+      policy->onPreempt(state, execIndex, currentTime);
+      TraceEnd(TRACE_PREEMPT, &processes[execIndex], start);
+      prevExecIndex = execIndex;
+      execIndex = -1;
+    }
+
+    if (execIndex == -1) {
+      int slice;
+      int64_t start = TraceBegin();
+      execIndex = policy->pickNext(state, currentTime, &slice);
+      TraceEnd(TRACE_PICK, execIndex != -1 ? &processes[execIndex] : NULL,
+               start);
+      if (execIndex == -1) {
+        if (i == n) {
+          fprintf(stderr, "%s: no process to run\n", policy->name);
+          abort();
+        }
+        currentTime = WaitUntil(processes[i].readyTime);
+        continue;
       }
-#endif
-      SET_PRIORITY(processes[execIndex].pid, SCHED_RR, maxPriority);
-      if (!processes[execIndex].started) {
-        START_PROCESS(processes[execIndex]);
-        processes[execIndex].started = true;
+      sliceEnd = slice < INT_MAX - currentTime ? currentTime + slice : INT_MAX;
+      if (execIndex != prevExecIndex || dispatcher.backend->renew) {
 #ifdef DEBUG
-        //printf("P%d started\n", execIndex + 1);
+        printf("%d: P%d chosen (%d)\n", currentTime, execIndex + 1,
+               jobs[execIndex].execTime);
 #endif
+        PICK_PROCESS(processes[execIndex]);
+        int units = jobs[execIndex].execTime;
+        if (sliceEnd - currentTime < units)
+          units = sliceEnd - currentTime;
+        Switch(prevExecIndex != -1 ? &processes[prevExecIndex] : NULL,
+               &processes[execIndex], units);
+        if (!processes[execIndex].started) {
+          START_PROCESS(processes[execIndex]);
+          processes[execIndex].started = true;
+        }
+        // the preempted process only stops once the next one runs
+        // a child that has been reaped has no cpu time to read
+        if (measure && prevExecIndex != -1 &&
+            !processes[prevExecIndex].exited) {
+          Overran(ChildCpuTime(processes[prevExecIndex].pid) -
+                  dispatchCpuTime - (int64_t)((currentTime - dispatchTime) *
+                                              timekeeper.nsPerUnit));
+        }
+        dispatchTime = currentTime;
+        if (measure && !processes[execIndex].exited)
+          dispatchCpuTime = ChildCpuTime(processes[execIndex].pid);
       }
     }
-    prevExecIndex = execIndex;
-    prevExecTime = processes[execIndex].execTime;
-  }
-}
 
-void PolicySJF(Process* processes, int n) {
-  int maxPriority = sched_get_priority_max(SCHED_FIFO);
-  SET_PRIORITY(0, SCHED_FIFO, maxPriority);
-  UNITS_OF_TIME(processes[0].readyTime);
-  int currentTime = processes[0].readyTime;
-  for (int i = 0; i < n; ++i) {
-    int execTime = INT_MAX;
-    int execIndex = -1;
-    for (int j = 0; j < n && processes[j].readyTime <= currentTime; ++j) {
-#ifdef DEBUG
-      printf("process[%d].readyTime = %d, process[%d].execTime = %d, "
-             "currentTime = %d\n", j, processes[j].readyTime,
-                                   j, processes[j].execTime, currentTime);
-#endif
-      if (!processes[j].started && processes[j].execTime < execTime) {
-        execTime = processes[j].execTime;
-        execIndex = j;
+    int finishTime = currentTime + jobs[execIndex].execTime;
+    int nextTime = finishTime;
+    if (sliceEnd < nextTime)
+      nextTime = sliceEnd;
+    if (i < n && processes[i].readyTime < nextTime)
+      nextTime = processes[i].readyTime;
+    if (processes[execIndex].exited) {
+      // the child finished its work ahead of the simulation
+      nextTime = currentTime;
+    } else if (nextTime == finishTime && !options->closedLoop) {
+      WaitExit(&processes[execIndex]);
+      Reached(nextTime);
+    } else {
+      nextTime = WaitUntil(nextTime);
+    }
+    int progress = Progressed(&processes[execIndex], nextTime - currentTime);
+    if (!options->closedLoop) {
+      jobs[execIndex].execTime -= nextTime - currentTime;
+    } else {
+      // a child that fell behind keeps its time slice for as long as it
+      // lagged, and one that ran ahead loses as much of it
+      if (progress > jobs[execIndex].execTime)
+        progress = jobs[execIndex].execTime;
+      jobs[execIndex].execTime -= progress;
+      if (sliceEnd != INT_MAX) {
+        sliceEnd += nextTime - currentTime - progress;
+        if (sliceEnd < nextTime)
+          sliceEnd = nextTime;
       }
+      // the child is done with its work but has yet to exit
+      if (jobs[execIndex].execTime == 0 && !processes[execIndex].exited)
+        WaitExit(&processes[execIndex]);
+    }
+    if (processes[execIndex].exited)
+      jobs[execIndex].execTime = 0;
+    currentTime = nextTime;
+    if (jobs[execIndex].execTime == 0) {
+      processes[execIndex].finished = true;
+      Finished(&processes[execIndex]);
+      ++finishedProcesses;
+      if (policy->onFinish) {
+        int64_t start = TraceBegin();
+        policy->onFinish(state, execIndex, currentTime);
+        TraceEnd(TRACE_FINISH, &processes[execIndex], start);
+      }
+      execIndex = -1;
     }
-#ifdef DEBUG
-    fprintf(stderr, "starting process P%d\n", execIndex + 1);
-    if (i > n) abort();
-#endif
-    SET_PRIORITY(processes[execIndex].pid, SCHED_FIFO, maxPriority);
-    START_PROCESS(processes[execIndex]);
-    processes[execIndex].started = true;
-    if (waitpid(processes[execIndex].pid, NULL, 0) < 0) ERROR;
-    currentTime += execTime;
   }
+
+  if (options->reportPolicy && policy->report)
+    policy->report(state, stderr);
+  policy->destroy(state);
+  free(jobs);
 }
 
-void PolicyPSJF(Process* processes, int n) {
-  int maxPriority = sched_get_priority_max(SCHED_RR);
-  SET_PRIORITY(0, SCHED_RR, maxPriority);
+// Runs the policy on several cpus, each with its own run queue. Arriving
+// processes join the queue of the least loaded cpu, and a cpu whose queue
+// is empty steals a process from the longest queue. The parent handles
+// events in order of simulated time: completions (for which it waits on the
+// children), then arrivals, then the end of round robin time slices. A child
+// that exits ahead of the simulation completes as soon as it does.
+void PolicyMultiCPU(Process* processes, int n,
+                    const RunQueueDiscipline* discipline,
+                    const Options* options) {
+  bool shortestFirst = discipline->shortestFirst;
+  bool roundRobin = discipline->roundRobin;
+  bool preemptive = discipline->preemptive;
+  int schedPolicy = roundRobin || preemptive ? SCHED_RR : SCHED_FIFO;
+  int maxPriority = sched_get_priority_max(schedPolicy);
+  SET_PRIORITY(0, schedPolicy, maxPriority);
+  TimekeeperStart();
+
+  int m = options->cpuCount;
+  Worker* workers = malloc(sizeof(Worker) * m);
+  if (!workers) ERROR;
+  for (int c = 0; c < m; ++c) {
+    workers[c].cpu = options->cpus[c];
+    RunQueueInit(&workers[c].queue, shortestFirst);
+    workers[c].running = workers[c].previous = -1;
+  }
+
   int currentTime = 0;
-  int prevExecIndex = -1;
-  int prevExecTime = INT_MAX;
-  for (int i = 0, remainingProcesses = n; remainingProcesses > 0;) {
-    int waitingTime;
-    bool preempted = false;
-    if (i == n ||
-        ((waitingTime = processes[i].readyTime - currentTime) >= prevExecTime &&
-        prevExecIndex != -1)) {
-#ifdef DEBUG
-      printf("i = %d, waitingTime = %d, "
-             "prevExecTime = %d, waiting for %d\n", i, waitingTime,
-                                                    prevExecTime,
-                                                    processes[prevExecIndex].pid);
-#endif
-      waitingTime = prevExecTime;
-      if (waitpid(processes[prevExecIndex].pid, NULL, 0) < 0) ERROR;
-      processes[prevExecIndex].finished = true;
-      --remainingProcesses;
+  for (int i = 0, finishedProcesses = 0; finishedProcesses < n;) {
+    // find the next event
+    int nextTime = i < n ? processes[i].readyTime : INT_MAX;
+    bool completion = false;
+    for (int c = 0; c < m; ++c) {
+      if (workers[c].running == -1)
+        continue;
+      const Process* process = &processes[workers[c].running];
+      int finishTime = process->exited ? currentTime :
+                                         currentTime + process->execTime;
+      if (finishTime < nextTime || (finishTime == nextTime && !completion)) {
+        nextTime = finishTime;
+        completion = true;
+      }
+      if (roundRobin && workers[c].sliceEnd < nextTime) {
+        nextTime = workers[c].sliceEnd;
+        completion = false;
+      }
+    }
+
+    if (completion) {
+      // the children are reaped in whatever order they exit
+      for (int c = 0; c < m; ++c) {
+        int execIndex = workers[c].running;
+        if (execIndex != -1 &&
+            currentTime + processes[execIndex].execTime == nextTime)
+          WaitExit(&processes[execIndex]);
+      }
+      Reached(nextTime);
     } else {
-      UNITS_OF_TIME(waitingTime);
-      preempted = true;
+      nextTime = WaitUntil(nextTime);
     }
-    currentTime += waitingTime;
-#ifdef DEBUG
-    printf("currentTime = %d\n", currentTime);
-#endif
-    if (prevExecIndex != -1)
-      processes[prevExecIndex].execTime -= waitingTime;
-    int execTime = INT_MAX;
-    int execIndex = -1;
-    for (i = 0; i < n && processes[i].readyTime <= currentTime; ++i) {
-      if (!processes[i].finished && processes[i].execTime < execTime) {
-        execTime = processes[i].execTime;
-        execIndex = i;
+    for (int c = 0; c < m; ++c) {
+      int execIndex = workers[c].running;
+      if (execIndex == -1)
+        continue;
+      processes[execIndex].execTime -= nextTime - currentTime;
+      if (processes[execIndex].exited) {
+        processes[execIndex].execTime = 0;
+        processes[execIndex].finished = true;
+        ++finishedProcesses;
+        workers[c].running = -1;
       }
     }
-#ifdef DEBUG
-    printf("current time = %d, process P%d chosen\n", currentTime,
-           execIndex + 1);
-#endif
-    if (execIndex != prevExecIndex && execIndex != -1) {
-      if (prevExecIndex != -1 && preempted) {
-        SET_PRIORITY(processes[prevExecIndex].pid, SCHED_RR, maxPriority - 1);
-#ifdef DEBUG
-        printf("decrease priority of P%d (%d)\n", prevExecIndex + 1,
-                                                  processes[prevExecIndex].pid);
-#endif
+    currentTime = nextTime;
+
+    for (; i < n && processes[i].readyTime <= currentTime; ++i) {
+      int64_t start = TraceBegin();
+      int target = 0;
+      int targetLoad = INT_MAX;
+      for (int c = 0; c < m; ++c) {
+        int load = RunQueueSize(&workers[c].queue) +
+                   (workers[c].running != -1);
+        if (load < targetLoad) {
+          target = c;
+          targetLoad = load;
+        }
       }
-      SET_PRIORITY(processes[execIndex].pid, SCHED_RR, maxPriority);
+      RunQueuePush(&workers[target].queue, i, processes[i].execTime);
+      TraceEnd(TRACE_ARRIVAL, &processes[i], start);
+    }
+
+    // put back processes whose time slice ended, or all running processes
+    // for PSJF so that they compete with the ones that arrived
+    for (int c = 0; c < m; ++c) {
+      if (workers[c].running != -1 &&
+          (preemptive || (roundRobin && workers[c].sliceEnd == currentTime))) {
+        RunQueuePush(&workers[c].queue, workers[c].running,
+                     processes[workers[c].running].execTime);
+        workers[c].previous = workers[c].running;
+        workers[c].running = -1;
+      }
+    }
+
+    // dispatch from each cpu's own queue first, then let idle cpus steal
+    for (int pass = 0; pass < 2; ++pass) {
+      for (int c = 0; c < m; ++c) {
+        Worker* worker = &workers[c];
+        if (worker->running != -1)
+          continue;
+        int64_t start = TraceBegin();
+        int execIndex = -1;
+        if (pass == 0 && RunQueueSize(&worker->queue) > 0) {
+          execIndex = RunQueuePop(&worker->queue);
+        } else if (pass == 1) {
+          Worker* victim = NULL;
+          for (int v = 0; v < m; ++v) {
+            if (RunQueueSize(&workers[v].queue) > 0 &&
+                (!victim || RunQueueSize(&workers[v].queue) >
+                            RunQueueSize(&victim->queue)))
+              victim = &workers[v];
+          }
+          if (victim)
+            execIndex = RunQueueSteal(&victim->queue);
+        }
+        if (execIndex == -1)
+          continue;
+        TraceEnd(TRACE_PICK, &processes[execIndex], start);
 #ifdef DEBUG
-      printf("increase priority of P%d (%d)\n", execIndex + 1,
-                                                processes[execIndex].pid);
+        printf("%d: P%d dispatched on cpu %d\n", currentTime, execIndex + 1,
+               worker->cpu);
 #endif
-      if (!processes[execIndex].started) {
-        START_PROCESS(processes[execIndex]);
-        processes[execIndex].started = true;
+        worker->running = execIndex;
+        worker->sliceEnd = currentTime + options->quantum;
+        if (execIndex == worker->previous)
+          continue;
+        PICK_PROCESS(processes[execIndex]);
+        if (processes[execIndex].cpu != worker->cpu) {
+          start = TraceBegin();
+          SET_CPU(processes[execIndex].pid, worker->cpu);
+          TraceEnd(TRACE_MIGRATE, &processes[execIndex], start);
+          processes[execIndex].cpu = worker->cpu;
+        }
+        start = TraceBegin();
+        SET_PRIORITY(processes[execIndex].pid, schedPolicy, maxPriority);
+        TraceEnd(TRACE_RESUME, &processes[execIndex], start);
+        if (!processes[execIndex].started) {
+          START_PROCESS(processes[execIndex]);
+          processes[execIndex].started = true;
+        }
+      }
+    }
+    for (int c = 0; c < m; ++c) {
+      Worker* worker = &workers[c];
+      if (worker->previous != -1 && worker->previous != worker->running &&
+          !processes[worker->previous].finished) {
+        bool stolen = false;
+        for (int v = 0; v < m; ++v)
+          stolen |= workers[v].running == worker->previous;
+        if (!stolen) {
+          int64_t start = TraceBegin();
+          SET_PRIORITY(processes[worker->previous].pid, schedPolicy,
+                       maxPriority - 1);
+          TraceEnd(TRACE_SUSPEND, &processes[worker->previous], start);
+        }
+      }
+      worker->previous = -1;
+    }
+  }
+
+  for (int c = 0; c < m; ++c)
+    RunQueueFree(&workers[c].queue);
+  free(workers);
+}
+
+// parses a list of distinct cpus other than PARENT_CPU; *cpus is NULL if
+// it is invalid
+bool ParseCpus(const char* list, int** cpus, int* count) {
+  int capacity = 16;
+  *cpus = malloc(sizeof(int) * capacity);
+  if (!*cpus) ERROR;
+  *count = 0;
+  cpu_set_t seen;
+  CPU_ZERO(&seen);
+  bool valid = *list != '\0';
+  // comma-separated cpus or ranges of cpus in the form first-last
+  for (const char* p = list; valid && *p;) {
+    char* end;
+    long first = strtol(p, &end, 10);
+    long last = first;
+    valid = end != p;
+    if (valid && *end == '-') {
+      p = end + 1;
+      last = strtol(p, &end, 10);
+      valid = end != p;
+    }
+    valid = valid && first >= 0 && last >= first && last < CPU_SETSIZE;
+    for (long cpu = first; valid && cpu <= last; ++cpu) {
+      valid = cpu != PARENT_CPU && !CPU_ISSET(cpu, &seen);
+      if (!valid)
+        break;
+      CPU_SET(cpu, &seen);
+      if (*count == capacity) {
+        *cpus = realloc(*cpus, sizeof(int) * (capacity *= 2));
+        if (!*cpus) ERROR;
       }
+      (*cpus)[(*count)++] = cpu;
     }
-    prevExecIndex = execIndex;
-    prevExecTime = execTime;
+    if (valid && *end == ',')
+      ++end;
+    else if (*end != '\0')
+      valid = false;
+    p = end;
+  }
+  if (!valid) {
+    free(*cpus);
+    *cpus = NULL;
+    *count = 0;
   }
+  return valid;
 }
 
 pid_t ProcessInit(Process* process) {
@@ -360,14 +1205,40 @@ pid_t ProcessInit(Process* process) {
   if (childPid < 0) {
     ERROR;
   } else if (childPid == 0) {
-    SET_CPU(1);
-    if (write(process->fromChild[1], "r", 1) != 1) ERROR;
+    // the parent may already be running with a real-time policy
+    SET_PRIORITY(0, SCHED_OTHER, 0);
+    // a SCHED_DEADLINE child would preempt the parent on its cpu, so it is
+    // kept off PARENT_CPU; the kernel refuses SCHED_DEADLINE to tasks whose
+    // affinity is narrower than their root domain, so it is only admitted
+    // in an exclusive cpuset that leaves out PARENT_CPU. As with SET_CPU, a
+    // span the kernel cannot honor, as on a single cpu, is ignored.
+    if (spawner.childCpu == -1)
+      sched_setaffinity(0, sizeof(cpu_set_t), &spawner.span);
+    close(spawner.readyPipe[0]);
+    // only the parent waits for events
+    close(events.epoll);
+    close(events.timer);
+    close(events.childSignal);
+    if (write(spawner.readyPipe[1], "r", 1) != 1) ERROR;
+    close(spawner.readyPipe[1]);
 
 #ifdef DEBUG
     printf("P%d (%d) waiting for parent\n", process->index + 1, getpid());
 #endif
-    char c;
-    if (read(process->toChild[0], &c, 1) != 1) ERROR;
+    Shared* shared = process->shared;
+    spawner.self = shared;
+    if (dispatcher.backend->child)
+      dispatcher.backend->child(shared);
+    if (spawner.gate == GATE_FUTEX) {
+      while (__atomic_load_n(&shared->gate, __ATOMIC_ACQUIRE) == 0) {
+        if (syscall(SYS_futex, &shared->gate, FUTEX_WAIT, 0, NULL, NULL,
+                    0) < 0 && errno != EAGAIN && errno != EINTR) ERROR;
+      }
+    } else {
+      int signal;
+      if (sigwait(&spawner.startSignal, &signal) != 0) ERROR;
+    }
+    shared->startTime = MonotonicTime();
 #ifdef DEBUG
     printf("P%d (%d) resume\n", process->index + 1, getpid());
 #endif
@@ -377,7 +1248,7 @@ pid_t ProcessInit(Process* process) {
 
     childPid = getpid();
     printf("%s %d\n", process->name, childPid);
-    UNITS_OF_TIME(process->execTime);
+    Work(process->execTime);
 
     timespec finishTime;
     GetTime(&finishTime);
@@ -388,8 +1259,702 @@ pid_t ProcessInit(Process* process) {
   printf("child process %d running on cpu %d\n", childPid, sched_getcpu());
 #endif
 
-    exit(0);
+    // only flush our own output, not whatever else the parent had buffered
+    // when forking
+    fflush(stdout);
+    _exit(0);
   }
   return childPid;
 }
 
+void SpawnerInit(Process* processes, int n, const Options* options) {
+  spawner.processes = processes;
+  spawner.n = n;
+  spawner.next = 0;
+  spawner.idle = 0;
+  spawner.window = options->window;
+  spawner.gate = options->gate;
+  spawner.childCpu = options->cpus ? options->cpus[0] : DEFAULT_CHILD_CPU;
+  if (options->backend == BACKEND_DEADLINE)
+    spawner.childCpu = -1;
+  CPU_ZERO(&spawner.span);
+  if (options->cpus) {
+    for (int i = 0; i < options->cpuCount; ++i)
+      CPU_SET(options->cpus[i], &spawner.span);
+  } else {
+    for (long cpu = 0;
+         cpu < sysconf(_SC_NPROCESSORS_CONF) && cpu < CPU_SETSIZE; ++cpu) {
+      if (cpu != PARENT_CPU)
+        CPU_SET(cpu, &spawner.span);
+    }
+  }
+  spawner.shared = mmap(NULL, sizeof(Shared) * n, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (spawner.shared == MAP_FAILED) ERROR;
+  for (int i = 0; i < n; ++i)
+    processes[i].shared = &spawner.shared[i];
+  spawner.forked = malloc(sizeof(Process*) * (spawner.window + 1));
+  if (!spawner.forked) ERROR;
+  if (pipe(spawner.readyPipe) == -1) ERROR;
+  sigemptyset(&spawner.startSignal);
+  sigaddset(&spawner.startSignal, SIGUSR1);
+  if (sigprocmask(SIG_BLOCK, &spawner.startSignal, NULL) < 0) ERROR;
+  SpawnAhead();
+}
+
+void Spawn(Process* process) {
+  if (process->pid != 0)
+    return;
+  int64_t start = TraceBegin();
+  process->pid = ProcessInit(process);
+  ++spawner.idle;
+  spawner.forked[0] = process;
+  SpawnWait(1);
+  TraceEnd(TRACE_SPAWN, process, start);
+}
+
+void SpawnAhead() {
+  int64_t start = TraceBegin();
+  int forked = 0;
+  for (; spawner.next < spawner.n && spawner.idle < spawner.window;
+       ++spawner.next) {
+    Process* process = &spawner.processes[spawner.next];
+    if (process->pid == 0) {
+      process->pid = ProcessInit(process);
+      ++spawner.idle;
+      spawner.forked[forked++] = process;
+    }
+  }
+  SpawnWait(forked);
+  if (forked > 0)
+    TraceEnd(TRACE_SPAWN, NULL, start);
+}
+
+// waits for the last forked children to report, then moves them to the cpu
+// reserved for children
+void SpawnWait(int forked) {
+  for (int i = 0; i < forked; ++i) {
+    char c;
+    if (read(spawner.readyPipe[0], &c, 1) != 1) ERROR;
+  }
+  for (int i = 0; i < forked; ++i) {
+    if (spawner.childCpu != -1)
+      SET_CPU(spawner.forked[i]->pid, spawner.childCpu);
+    spawner.forked[i]->cpu = spawner.childCpu;
+    Watch(spawner.forked[i]);
+  }
+}
+
+// called when the policy decides to run process next, before changing any
+// priorities
+void Pick(Process* process) {
+  if (!process->started)
+    process->shared->pickTime = MonotonicTime();
+  Spawn(process);
+  TimingDrain();
+}
+
+void Start(Process* process) {
+  int64_t start = TraceBegin();
+  if (spawner.gate == GATE_FUTEX) {
+    __atomic_store_n(&process->shared->gate, 1, __ATOMIC_RELEASE);
+    if (syscall(SYS_futex, &process->shared->gate, FUTEX_WAKE, 1, NULL, NULL,
+                0) < 0) ERROR;
+  } else {
+    if (kill(process->pid, SIGUSR1) < 0) ERROR;
+  }
+  TraceEnd(TRACE_START, process, start);
+  --spawner.idle;
+  SpawnAhead();
+}
+
+int64_t MonotonicTime() {
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+void DispatcherInit(const Options* options) {
+  dispatcher.backend = &backends[options->backend];
+  dispatcher.maxPriority = sched_get_priority_max(SCHED_FIFO);
+  dispatcher.switches = dispatcher.syscalls = 0;
+  dispatcher.cost = malloc(sizeof(Histogram));
+  dispatcher.wakeLatency = malloc(sizeof(Histogram));
+  dispatcher.overrun = malloc(sizeof(Histogram));
+  if (!dispatcher.cost || !dispatcher.wakeLatency || !dispatcher.overrun)
+    ERROR;
+  HistogramInit(dispatcher.cost);
+  HistogramInit(dispatcher.wakeLatency);
+  HistogramInit(dispatcher.overrun);
+  dispatcher.resumed = false;
+  dispatcher.overrunSum = 0;
+  dispatcher.maxOverrun = dispatcher.maxUnderrun = 0;
+  dispatcher.refused = 0;
+  dispatcher.denied = 0;
+  dispatcher.tooLong = 0;
+  dispatcher.assumedProgress = dispatcher.actualProgress = 0;
+  dispatcher.progressError = malloc(sizeof(Histogram));
+  if (!dispatcher.progressError) ERROR;
+  HistogramInit(dispatcher.progressError);
+}
+
+// suspends the previous process, if any, and lets next run for units of
+// time, timing how long it takes the parent
+void Switch(Process* previous, Process* next, int units) {
+  int64_t start = MonotonicTime();
+  // a child that has already exited is neither suspended nor resumed
+  if (previous && !previous->exited) {
+    if (dispatcher.resumed)
+      Woke(previous);
+    int64_t suspendStart = TraceBegin();
+    dispatcher.backend->suspend(previous);
+    TraceEnd(TRACE_SUSPEND, previous, suspendStart);
+  }
+  // only a process that has been stopped can notice being resumed
+  dispatcher.resumed = next->started && !next->exited;
+  next->shared->resumeTime = 0;
+  if (!next->exited) {
+    int64_t resumeStart = TraceBegin();
+    dispatcher.backend->resume(next, units);
+    TraceEnd(TRACE_RESUME, next, resumeStart);
+  }
+  int64_t finish = MonotonicTime();
+  HistogramRecord(dispatcher.cost, finish - start);
+  dispatcher.switchStart = start;
+  ++dispatcher.switches;
+}
+
+// records how long the running process took to notice it was resumed, if
+// the backend lets it tell
+void Woke(const Process* process) {
+  int64_t resumeTime = __atomic_load_n(&process->shared->resumeTime,
+                                       __ATOMIC_ACQUIRE);
+  if (resumeTime != 0)
+    HistogramRecord(dispatcher.wakeLatency,
+                    resumeTime - dispatcher.switchStart);
+}
+
+// called once the running process has been reaped
+void Finished(Process* process) {
+  if (dispatcher.resumed)
+    Woke(process);
+  dispatcher.resumed = false;
+}
+
+// raises the process above the others; it goes on running until it is
+// suspended
+void PriorityResume(Process* process, int units) {
+  SET_PRIORITY(process->pid, SCHED_FIFO, dispatcher.maxPriority);
+  ++dispatcher.syscalls;
+}
+
+// lowers a preempted process below the one that runs next
+void PrioritySuspend(Process* process) {
+  SET_PRIORITY(process->pid, SCHED_FIFO, dispatcher.maxPriority - 1);
+  ++dispatcher.syscalls;
+}
+
+// gives the process a SCHED_DEADLINE budget of units of time and continues
+// it if it was stopped
+void DeadlineResume(Process* process, int units) {
+  double runtime = units * timekeeper.nsPerUnit * (100 + DEADLINE_HEADROOM) /
+                   100;
+  if (runtime < DEADLINE_MIN_RUNTIME) runtime = DEADLINE_MIN_RUNTIME;
+  bool admitted = false;
+  if (runtime > DEADLINE_MAX_RUNTIME) {
+    ++dispatcher.tooLong;
+  } else {
+    double period = runtime * 100 / DEADLINE_BANDWIDTH;
+    SchedAttr attr = { sizeof(SchedAttr), SCHED_DEADLINE, 0, 0, 0, runtime,
+                       period, period };
+    ++dispatcher.syscalls;
+    admitted = syscall(SYS_sched_setattr, process->pid, &attr, 0) == 0;
+    if (!admitted) {
+      if (errno == EBUSY)
+        ++dispatcher.refused;
+      else if (errno == EPERM)
+        ++dispatcher.denied;
+      else
+        ERROR;
+    }
+  }
+  if (!admitted)
+    PriorityResume(process, units);
+  SignalResume(process, units);
+}
+
+// records when the child is continued after being stopped
+void SignalChild(Shared* shared) {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = ContinueHandler;
+  action.sa_flags = SA_RESTART;
+  if (sigaction(SIGCONT, &action, NULL) < 0) ERROR;
+}
+
+void ContinueHandler(int signal) {
+  __atomic_store_n(&spawner.self->resumeTime, MonotonicTime(),
+                   __ATOMIC_RELEASE);
+}
+
+// only children that have not been reaped are signalled, so their pid
+// cannot have been reused by another process; a child that has not been
+// started is still waiting at its gate and does not need to be continued
+void SignalResume(Process* process, int units) {
+  if (!process->started)
+    return;
+  if (kill(process->pid, SIGCONT) < 0) ERROR;
+  ++dispatcher.syscalls;
+}
+
+void SignalSuspend(Process* process) {
+  if (kill(process->pid, SIGSTOP) < 0) ERROR;
+  ++dispatcher.syscalls;
+}
+
+void YieldChild(Shared* shared) {
+  spawner.yielding = shared;
+}
+
+// sets the flag of the process and wakes it if it is blocked on it
+void YieldResume(Process* process, int units) {
+  __atomic_store_n(&process->shared->run, 1, __ATOMIC_RELEASE);
+  if (!process->started)
+    return;
+  if (syscall(SYS_futex, &process->shared->run, FUTEX_WAKE, 1, NULL, NULL,
+              0) < 0) ERROR;
+  ++dispatcher.syscalls;
+}
+
+// clears the flag of the process, which blocks at its next check
+void YieldSuspend(Process* process) {
+  __atomic_store_n(&process->shared->run, 0, __ATOMIC_RELEASE);
+}
+
+// called by a child with BACKEND_YIELD as it works, blocks while its flag is
+// cleared
+void YieldPoint(Shared* shared) {
+  if (__atomic_load_n(&shared->run, __ATOMIC_ACQUIRE) != 0)
+    return;
+  while (__atomic_load_n(&shared->run, __ATOMIC_ACQUIRE) == 0) {
+    if (syscall(SYS_futex, &shared->run, FUTEX_WAIT, 0, NULL, NULL, 0) < 0 &&
+        errno != EAGAIN && errno != EINTR) ERROR;
+  }
+  __atomic_store_n(&shared->resumeTime, MonotonicTime(), __ATOMIC_RELEASE);
+}
+
+void Overran(int64_t overrun) {
+  HistogramRecord(dispatcher.overrun, overrun < 0 ? -overrun : overrun);
+  dispatcher.overrunSum += overrun;
+  if (overrun > dispatcher.maxOverrun) dispatcher.maxOverrun = overrun;
+  if (-overrun > dispatcher.maxUnderrun) dispatcher.maxUnderrun = -overrun;
+}
+
+// returns the units of work the running process reported since the last
+// call, which the parent assumed to be the units of time that passed
+int Progressed(Process* process, int assumed) {
+  int progress = __atomic_load_n(&process->shared->progress,
+                                 __ATOMIC_ACQUIRE);
+  int actual = progress - process->progress;
+  process->progress = progress;
+  dispatcher.assumedProgress += assumed;
+  dispatcher.actualProgress += actual;
+  HistogramRecord(dispatcher.progressError,
+                  assumed > actual ? assumed - actual : actual - assumed);
+  return actual;
+}
+
+int64_t ChildCpuTime(pid_t pid) {
+  clockid_t clock;
+  if (clock_getcpuclockid(pid, &clock) != 0) ERROR;
+  timespec t;
+  if (clock_gettime(clock, &t) < 0) ERROR;
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+// prints the distribution of the time from picking a process to run until it
+// starts running and, for the single-cpu policies, what switching between
+// processes cost, how far the work children reported was from what the parent
+// assumed and of how much longer or shorter than their time slice preempted
+// processes ran, in microseconds, to stderr
+void ReportDispatch(const Process* processes, int n, const Options* options) {
+  Histogram* histogram = malloc(sizeof(Histogram));
+  if (!histogram) ERROR;
+  HistogramInit(histogram);
+  for (int i = 0; i < n; ++i) {
+    if (processes[i].shared->startTime != 0)
+      HistogramRecord(histogram, processes[i].shared->startTime -
+                                 processes[i].shared->pickTime);
+  }
+  fprintf(stderr, "dispatch latency (%s gate, us): mean %.3f, p50 %.3f, "
+                  "p90 %.3f, p99 %.3f, max %.3f\n",
+          options->gate == GATE_FUTEX ? "futex" : "signal",
+          HistogramMean(histogram) / 1000,
+          HistogramPercentile(histogram, 50) / 1000.0,
+          HistogramPercentile(histogram, 90) / 1000.0,
+          HistogramPercentile(histogram, 99) / 1000.0,
+          histogram->max / 1000.0);
+  free(histogram);
+
+  const Histogram* cost = dispatcher.cost;
+  if (dispatcher.switches > 0) {
+    fprintf(stderr, "switches (%s backend): %lld, %.2f syscalls per switch, "
+                    "cost (us) mean %.3f, p50 %.3f, p99 %.3f, max %.3f\n",
+            dispatcher.backend->name, dispatcher.switches,
+            (double)dispatcher.syscalls / dispatcher.switches,
+            HistogramMean(cost) / 1000,
+            HistogramPercentile(cost, 50) / 1000.0,
+            HistogramPercentile(cost, 99) / 1000.0, cost->max / 1000.0);
+  }
+  const Histogram* wakeLatency = dispatcher.wakeLatency;
+  if (wakeLatency->count > 0) {
+    fprintf(stderr, "wake latency (%s backend, us): mean %.3f, p50 %.3f, "
+                    "p90 %.3f, p99 %.3f, max %.3f\n",
+            dispatcher.backend->name, HistogramMean(wakeLatency) / 1000,
+            HistogramPercentile(wakeLatency, 50) / 1000.0,
+            HistogramPercentile(wakeLatency, 90) / 1000.0,
+            HistogramPercentile(wakeLatency, 99) / 1000.0,
+            wakeLatency->max / 1000.0);
+  }
+
+  const Histogram* progressError = dispatcher.progressError;
+  if (progressError->count > 0) {
+    fprintf(stderr, "progress difference (%s loop, units): |difference| "
+                    "mean %.3f, p50 %lld, p99 %lld, max %lld\n",
+            options->closedLoop ? "closed" : "open",
+            HistogramMean(progressError),
+            (long long)HistogramPercentile(progressError, 50),
+            (long long)HistogramPercentile(progressError, 99),
+            (long long)progressError->max);
+  }
+
+  const Histogram* overrun = dispatcher.overrun;
+  if (overrun->count > 0) {
+    fprintf(stderr, "slice overrun (%s backend, us): mean %.3f, |overrun| "
+                    "p50 %.3f, p90 %.3f, p99 %.3f, max over %.3f, max under "
+                    "%.3f\n", dispatcher.backend->name,
+            dispatcher.overrunSum / overrun->count / 1000,
+            HistogramPercentile(overrun, 50) / 1000.0,
+            HistogramPercentile(overrun, 90) / 1000.0,
+            HistogramPercentile(overrun, 99) / 1000.0,
+            dispatcher.maxOverrun / 1000.0, dispatcher.maxUnderrun / 1000.0);
+  }
+  if (options->backend == BACKEND_DEADLINE)
+    fprintf(stderr, "refused deadline budgets: %d, not permitted %d, too "
+                    "long %d\n", dispatcher.refused, dispatcher.denied,
+            dispatcher.tooLong);
+}
+
+// prints the units of time the parent assumed the running processes worked
+// and the units they reported to stderr
+void ReportProgress(const Options* options) {
+  if (dispatcher.progressError->count == 0)
+    return;
+  fprintf(stderr, "progress (%s loop, units): assumed %lld, reported %lld\n",
+          options->closedLoop ? "closed" : "open", dispatcher.assumedProgress,
+          dispatcher.actualProgress);
+}
+
+void TimekeeperInit(const Options* options) {
+  timekeeper.mode = options->timekeeping;
+  timekeeper.currentTime = 0;
+  timekeeper.timedWork = options->nsPerUnit != 0;
+  // drift and dispatch reports calibrate the unit as well, but do not change
+  // how the parent keeps time
+  if (timekeeper.mode == TIMEKEEPING_AUTO) {
+    timekeeper.mode = timekeeper.timedWork ||
+                      options->backend == BACKEND_DEADLINE ?
+                      TIMEKEEPING_SLEEP : TIMEKEEPING_SPIN;
+  }
+  timekeeper.calibrated = timekeeper.mode == TIMEKEEPING_SLEEP ||
+                          options->reportDrift || timekeeper.timedWork ||
+                          options->reportDispatch ||
+                          options->backend == BACKEND_DEADLINE;
+  if (!timekeeper.calibrated)
+    return;
+
+  if (options->nsPerUnit > 0) {
+    timekeeper.nsPerUnit = options->nsPerUnit;
+  } else {
+    // a unit is as long as UNITS_OF_TIME(1) takes on this machine
+    UNITS_OF_TIME(1);
+    int64_t start = MonotonicTime();
+    UNITS_OF_TIME(options->calibrationUnits);
+    timekeeper.nsPerUnit = (double)(MonotonicTime() - start) /
+                           options->calibrationUnits;
+  }
+  timekeeper.drift = malloc(sizeof(Histogram));
+  if (!timekeeper.drift) ERROR;
+  HistogramInit(timekeeper.drift);
+  timekeeper.driftSum = 0;
+  timekeeper.maxLate = timekeeper.maxEarly = 0;
+}
+
+// marks the current time as simulated time 0
+void TimekeeperStart() {
+  timekeeper.currentTime = 0;
+  timekeeper.epoch = MonotonicTime();
+}
+
+void EventLoopInit(int n) {
+  events.epoll = epoll_create1(EPOLL_CLOEXEC);
+  if (events.epoll < 0) ERROR;
+  events.timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (events.timer < 0) ERROR;
+  struct epoll_event event = { EPOLLIN, { .ptr = NULL } };
+  if (epoll_ctl(events.epoll, EPOLL_CTL_ADD, events.timer, &event) < 0) ERROR;
+  // SIGCHLD is only delivered through the signalfd
+  sigset_t childSignal;
+  sigemptyset(&childSignal);
+  sigaddset(&childSignal, SIGCHLD);
+  if (sigprocmask(SIG_BLOCK, &childSignal, NULL) < 0) ERROR;
+  events.childSignal = signalfd(-1, &childSignal, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (events.childSignal < 0) ERROR;
+  event.data.ptr = EVENT_CHILD;
+  if (epoll_ctl(events.epoll, EPOLL_CTL_ADD, events.childSignal, &event) < 0)
+    ERROR;
+  for (events.capacity = 1; events.capacity < 2 * n; events.capacity *= 2);
+  events.children = calloc(events.capacity, sizeof(Process*));
+  if (!events.children) ERROR;
+}
+
+// returns the slot of the live child with pid, or the empty slot it would be
+// put in; a slot of a child that exited is reused by a later child that gets
+// the same pid
+Process** WatchedSlot(pid_t pid) {
+  int i = (uint32_t)pid * 2654435761u & (events.capacity - 1);
+  for (; events.children[i] && events.children[i]->pid != pid;
+       i = (i + 1) & (events.capacity - 1));
+  return &events.children[i];
+}
+
+// watches a forked child for its exit
+void Watch(Process* process) {
+  *WatchedSlot(process->pid) = process;
+}
+
+// waits for at most timeout milliseconds, or indefinitely if it is -1, and
+// returns the events that happened; children that exited are reaped
+int WaitEvents(int timeout) {
+  struct epoll_event ready[EVENT_BATCH];
+  int count;
+  while ((count = epoll_wait(events.epoll, ready, EVENT_BATCH, timeout)) < 0)
+    if (errno != EINTR) ERROR;
+  int happened = 0;
+  for (int i = 0; i < count; ++i) {
+    if (!ready[i].data.ptr) {
+      uint64_t expirations;
+      if (read(events.timer, &expirations, sizeof(expirations)) < 0 &&
+          errno != EAGAIN) ERROR;
+      happened |= EVENT_TIMER;
+      continue;
+    }
+    // SIGCHLD is not queued, so one signal may stand for several exits
+    struct signalfd_siginfo signals[EVENT_BATCH];
+    while (read(events.childSignal, signals, sizeof(signals)) > 0);
+    if (errno != EAGAIN) ERROR;
+    while (true) {
+      int64_t start = TraceBegin();
+      siginfo_t info;
+      info.si_pid = 0;
+      if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG) < 0) {
+        if (errno == ECHILD) break;
+        ERROR;
+      }
+      if (info.si_pid == 0)
+        break;
+      Process* process = *WatchedSlot(info.si_pid);
+      if (!process) {
+        errno = ECHILD;
+        ERROR;
+      }
+      TraceEnd(TRACE_REAP, process, start);
+      process->exited = true;
+      happened |= EVENT_EXIT;
+    }
+  }
+  return happened;
+}
+
+// waits until the child has exited, reaping any other that exits first
+void WaitExit(Process* process) {
+  while (!process->exited)
+    WaitEvents(-1);
+}
+
+// advances the parent to simulated time, or less if a child exits first, and
+// returns the time reached
+int WaitUntil(int time) {
+  if (timekeeper.mode == TIMEKEEPING_SLEEP) {
+    int64_t deadline = timekeeper.epoch + time * timekeeper.nsPerUnit;
+    struct itimerspec t = { { 0, 0 }, { deadline / 1000000000,
+                                        deadline % 1000000000 } };
+    // also clears an expiration left over from an earlier deadline
+    if (timerfd_settime(events.timer, TFD_TIMER_ABSTIME, &t, NULL) < 0)
+      ERROR;
+    while (!(WaitEvents(-1) & EVENT_TIMER)) {
+      int reached = (MonotonicTime() - timekeeper.epoch) /
+                    timekeeper.nsPerUnit;
+      if (reached < timekeeper.currentTime)
+        reached = timekeeper.currentTime;
+      if (reached < time) {
+        Reached(reached);
+        return reached;
+      }
+    }
+  } else {
+    // the parent checks for exited children after every unit of time
+    for (int reached = timekeeper.currentTime; reached < time;) {
+      Work(1);
+      ++reached;
+      if (reached < time && (WaitEvents(0) & EVENT_EXIT)) {
+        Reached(reached);
+        return reached;
+      }
+    }
+  }
+  Reached(time);
+  return time;
+}
+
+// records that an event scheduled at simulated time happened now
+void Reached(int time) {
+  timekeeper.currentTime = time;
+  if (!timekeeper.calibrated)
+    return;
+  int64_t drift = MonotonicTime() -
+                  (int64_t)(timekeeper.epoch + time * timekeeper.nsPerUnit);
+  HistogramRecord(timekeeper.drift, drift < 0 ? -drift : drift);
+  timekeeper.driftSum += drift;
+  if (drift > timekeeper.maxLate) timekeeper.maxLate = drift;
+  if (-drift > timekeeper.maxEarly) timekeeper.maxEarly = -drift;
+}
+
+// prints how far the parent's events were from their scheduled time, in
+// microseconds, to stderr
+void ReportDrift() {
+  const Histogram* drift = timekeeper.drift;
+  fprintf(stderr, "event drift (%s timekeeping, %.0f ns per unit, us): "
+                  "mean %.3f, |drift| p50 %.3f, p90 %.3f, p99 %.3f, "
+                  "max late %.3f, max early %.3f\n",
+          timekeeper.mode == TIMEKEEPING_SLEEP ? "sleep" : "spin",
+          timekeeper.nsPerUnit,
+          drift->count ? timekeeper.driftSum / drift->count / 1000 : 0,
+          HistogramPercentile(drift, 50) / 1000.0,
+          HistogramPercentile(drift, 90) / 1000.0,
+          HistogramPercentile(drift, 99) / 1000.0,
+          timekeeper.maxLate / 1000.0, timekeeper.maxEarly / 1000.0);
+}
+
+// traces into memory if path is not NULL
+void TraceInit(const char* path) {
+  tracer.count = 0;
+  tracer.path = path;
+  if (!path)
+    return;
+  tracer.capacity = TRACE_INITIAL_CAPACITY;
+  tracer.records = malloc(sizeof(TraceRecord) * tracer.capacity);
+  if (!tracer.records) ERROR;
+}
+
+// returns the start time of an operation to pass to TraceEnd
+int64_t TraceBegin() {
+  return tracer.records ? MonotonicTime() : 0;
+}
+
+void TraceEnd(TraceType type, const Process* process, int64_t start) {
+  if (!tracer.records)
+    return;
+  if (tracer.count == tracer.capacity) {
+    tracer.capacity *= 2;
+    tracer.records = realloc(tracer.records,
+                             sizeof(TraceRecord) * tracer.capacity);
+    if (!tracer.records) ERROR;
+  }
+  TraceRecord* record = &tracer.records[tracer.count++];
+  record->start = start;
+  record->duration = MonotonicTime() - start;
+  record->type = type;
+  record->process = process ? process->index : -1;
+}
+
+// writes the trace and prints the distribution of the time each type of
+// operation took, in microseconds, to stderr
+void TraceClose() {
+  if (!tracer.records)
+    return;
+  FILE* file = fopen(tracer.path, "wb");
+  if (!file) ERROR;
+  TraceHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  header.version = TRACE_VERSION;
+  header.typeCount = TRACE_TYPES;
+  header.count = tracer.count;
+  if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+      fwrite(tracer.records, sizeof(TraceRecord), tracer.count, file) !=
+        tracer.count || fclose(file) != 0) ERROR;
+
+  Histogram* histograms = malloc(sizeof(Histogram) * TRACE_TYPES);
+  if (!histograms) ERROR;
+  for (int type = 0; type < TRACE_TYPES; ++type)
+    HistogramInit(&histograms[type]);
+  for (size_t i = 0; i < tracer.count; ++i)
+    HistogramRecord(&histograms[tracer.records[i].type],
+                    tracer.records[i].duration);
+  fprintf(stderr, "overhead (us):\n");
+  for (int type = 0; type < TRACE_TYPES; ++type) {
+    const Histogram* histogram = &histograms[type];
+    if (histogram->count == 0)
+      continue;
+    fprintf(stderr, "  %s: %llu, total %.3f, p50 %.3f, p99 %.3f, max %.3f\n",
+            traceNames[type], (unsigned long long)histogram->count,
+            histogram->sum / 1000, HistogramPercentile(histogram, 50) / 1000.0,
+            HistogramPercentile(histogram, 99) / 1000.0,
+            histogram->max / 1000.0);
+  }
+  free(histograms);
+  free(tracer.records);
+  tracer.records = NULL;
+}
+
+// runs for units of time, either as a fixed number of iterations or, with a
+// calibrated unit, until the process has used units * nsPerUnit of cpu time,
+// which does not advance while it is preempted; a child reports the units it
+// has completed after every unit or chunk, and with BACKEND_YIELD checks
+// whether it should block
+void Work(int units) {
+  Shared* self = spawner.self;
+  Shared* yielding = spawner.yielding;
+  if (!timekeeper.timedWork) {
+    if (!self) {
+      UNITS_OF_TIME(units);
+      return;
+    }
+    for (int unit = 0; unit < units; ++unit) {
+      if (yielding)
+        YieldPoint(yielding);
+      UNITS_OF_TIME(1);
+      __atomic_store_n(&self->progress, unit + 1, __ATOMIC_RELEASE);
+    }
+    return;
+  }
+  int64_t budget = units * timekeeper.nsPerUnit;
+  int64_t start = CpuTime();
+  for (int64_t used; (used = CpuTime() - start) < budget;) {
+    if (self)
+      __atomic_store_n(&self->progress, (int32_t)(used / timekeeper.nsPerUnit),
+                       __ATOMIC_RELEASE);
+    if (yielding)
+      YieldPoint(yielding);
+    for (volatile int i = 0; i < WORK_CHUNK; ++i);
+  }
+  if (self)
+    __atomic_store_n(&self->progress, units, __ATOMIC_RELEASE);
+}
+
+int64_t CpuTime() {
+  timespec t;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
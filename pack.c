@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "workload.h"
+
+// converts a text workload on stdin to the binary workload format on stdout
+
+typedef struct {
+  WorkloadRecord record;
+  int deadline;
+  int weight;
+  int index;
+} Entry;
+
+typedef struct {
+  char (*names)[WORKLOAD_NAME_SIZE];
+  uint32_t count;
+  // open addressing hash table of name ids, -1 if empty
+  int* table;
+  uint32_t mask;
+} NameTable;
+
+int EntryCmp(const void* pa, const void* pb);
+void NameTableInit(NameTable* table, int n);
+uint32_t NameTableIntern(NameTable* table, const char* name);
+
+int main() {
+  Reader reader;
+  if (!ReaderOpen(&reader, STDIN_FILENO)) abort();
+
+  WorkloadHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, WORKLOAD_MAGIC, sizeof(WORKLOAD_MAGIC));
+  header.version = WORKLOAD_VERSION;
+  if (!ReadToken(&reader, header.policy, sizeof(header.policy))) abort();
+
+  int n;
+  if (!ReadInt(&reader, &n) || n <= 0) abort();
+  Entry* entries = malloc(sizeof(Entry) * n);
+  NameTable names;
+  NameTableInit(&names, n);
+  for (int i = 0; i < n; ++i) {
+    char name[WORKLOAD_NAME_SIZE];
+    if (!ReadToken(&reader, name, sizeof(name)) ||
+        !ReadInt(&reader, &entries[i].record.readyTime) ||
+        !ReadInt(&reader, &entries[i].record.execTime)) abort();
+    entries[i].deadline = WORKLOAD_NO_DEADLINE;
+    entries[i].weight = WORKLOAD_DEFAULT_WEIGHT;
+    if (!ReadOptionalInt(&reader, &entries[i].deadline) ||
+        !ReadOptionalInt(&reader, &entries[i].weight) ||
+        entries[i].weight < 1) abort();
+    if (entries[i].deadline != WORKLOAD_NO_DEADLINE)
+      header.columns |= WORKLOAD_COLUMN_DEADLINE;
+    if (entries[i].weight != WORKLOAD_DEFAULT_WEIGHT)
+      header.columns |= WORKLOAD_COLUMN_WEIGHT;
+    entries[i].record.nameId = NameTableIntern(&names, name);
+    entries[i].index = i;
+  }
+  ReaderClose(&reader);
+
+  qsort(entries, n, sizeof(Entry), EntryCmp);
+
+  header.count = n;
+  header.nameCount = names.count;
+  size_t columnsSize = sizeof(int32_t) * n *
+                       __builtin_popcount(header.columns);
+  header.namesOffset = sizeof(WorkloadHeader) + sizeof(WorkloadRecord) * n +
+                       columnsSize;
+  header.namesOffset = (header.namesOffset + sizeof(uint64_t) - 1) &
+                       ~(uint64_t)(sizeof(uint64_t) - 1);
+  if (fwrite(&header, sizeof(header), 1, stdout) != 1) abort();
+  for (int i = 0; i < n; ++i) {
+    if (fwrite(&entries[i].record, sizeof(WorkloadRecord), 1, stdout) != 1)
+      abort();
+  }
+  for (int i = 0; i < n && (header.columns & WORKLOAD_COLUMN_DEADLINE); ++i) {
+    int32_t deadline = entries[i].deadline;
+    if (fwrite(&deadline, sizeof(deadline), 1, stdout) != 1) abort();
+  }
+  for (int i = 0; i < n && (header.columns & WORKLOAD_COLUMN_WEIGHT); ++i) {
+    int32_t weight = entries[i].weight;
+    if (fwrite(&weight, sizeof(weight), 1, stdout) != 1) abort();
+  }
+  static const char padding[sizeof(uint64_t)];
+  size_t paddingSize = header.namesOffset - sizeof(WorkloadHeader) -
+                       sizeof(WorkloadRecord) * n - columnsSize;
+  if (fwrite(padding, 1, paddingSize, stdout) != paddingSize) abort();
+  if (fwrite(names.names, WORKLOAD_NAME_SIZE, names.count, stdout) !=
+      names.count) abort();
+  if (fflush(stdout) != 0) abort();
+
+  free(entries);
+  free(names.names);
+  free(names.table);
+}
+
+int EntryCmp(const void* pa, const void* pb) {
+  const Entry* a = pa;
+  const Entry* b = pb;
+  return WorkloadOrder(a->record.readyTime, a->index, b->record.readyTime,
+                       b->index);
+}
+
+void NameTableInit(NameTable* table, int n) {
+  table->names = calloc(n, WORKLOAD_NAME_SIZE);
+  table->count = 0;
+  uint32_t size = 1;
+  while (size < 2 * (uint32_t)n)
+    size *= 2;
+  table->table = malloc(sizeof(int) * size);
+  memset(table->table, -1, sizeof(int) * size);
+  table->mask = size - 1;
+  if (!table->names || !table->table) abort();
+}
+
+uint32_t NameTableIntern(NameTable* table, const char* name) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (const char* c = name; *c; ++c)
+    hash = (hash ^ (unsigned char)*c) * 16777619u;
+  for (uint32_t i = hash & table->mask; true; i = (i + 1) & table->mask) {
+    if (table->table[i] == -1) {
+      strcpy(table->names[table->count], name);
+      table->table[i] = table->count;
+      return table->count++;
+    }
+    if (strcmp(table->names[table->table[i]], name) == 0)
+      return table->table[i];
+  }
+}
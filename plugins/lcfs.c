@@ -0,0 +1,40 @@
+#include "policy.h"
+
+// Example policy plugin: last come, first served. The most recently arrived
+// job runs next and is never preempted. Build with make plugins and select
+// it with -P plugins/lcfs.so and a workload whose policy is LCFS.
+
+static void* LCFSCreate(const PolicyJob* jobs, int n,
+                        const PolicyParams* params) {
+  JobRing* stack = malloc(sizeof(JobRing));
+  if (!stack) abort();
+  JobRingInit(stack);
+  return stack;
+}
+
+static void LCFSDestroy(void* state) {
+  JobRingFree(state);
+  free(state);
+}
+
+static bool LCFSOnArrival(void* state, int job, int time) {
+  JobRingPush(state, job);
+  return false;
+}
+
+static int LCFSPickNext(void* state, int time, int* slice) {
+  JobRing* stack = state;
+  if (stack->size == 0)
+    return -1;
+  *slice = POLICY_NO_SLICE;
+  return JobRingPopBack(stack);
+}
+
+static void LCFSOnPreempt(void* state, int job, int time) {
+  JobRingPush(state, job);
+}
+
+const Policy policyPlugin = {
+  POLICY_VERSION, "LCFS", LCFSCreate, LCFSDestroy, LCFSOnArrival, NULL,
+  LCFSPickNext, LCFSOnPreempt, NULL, NULL
+};
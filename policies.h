@@ -0,0 +1,967 @@
+#ifndef POLICIES_H
+#define POLICIES_H
+
+#include <dlfcn.h>
+#include "histogram.h"
+#include "policy.h"
+
+// The built-in policies and the policies loaded from plugins, looked up by
+// the name given in the workload.
+
+#define POLICY_MAX_PLUGINS 16
+#define DEFAULT_TARGET_LATENCY 2000
+#define DEFAULT_MIN_GRANULARITY 250
+#define MLFQ_MAX_LEVELS 32
+#define DEFAULT_MLFQ_LEVELS 3
+#define DEFAULT_BOOST_PERIOD 10000
+// pass a stride scheduled job of weight 1 advances per unit of time
+#define STRIDE_ONE (1 << 20)
+// seed of the lottery unless another one is given
+#define LOTTERY_SEED 0x9e3779b97f4a7c15ull
+// EDF key of jobs without a deadline, which run in arrival order after all
+// jobs with one
+#define EDF_BEST_EFFORT INT64_MAX
+
+// FIFO and RR: jobs run in order of arrival, for at most a quantum at a time
+// with RR, and a preempted job goes behind the jobs that arrived meanwhile
+typedef struct {
+  JobRing ring;
+  int slice;
+} ArrivalOrder;
+
+// SJF and PSJF: the job with the least remaining time runs first, and with
+// PSJF every arrival preempts the running job so it can be reconsidered
+typedef struct {
+  const PolicyJob* jobs;
+  JobHeap heap;
+} ShortestFirst;
+
+// CFS: every job accumulates virtual runtime while it runs, and the job with
+// the least virtual runtime runs next for an equal share of the target
+// latency, but at least the minimum granularity. Arriving jobs start at the
+// smallest virtual runtime of the runnable jobs, which never decreases, and
+// preempt the running job if it is ahead of them by more than the minimum
+// granularity.
+typedef struct {
+  JobTree tree;
+  int64_t* vruntime;
+  // includes the progress of the running job up to the last event
+  int64_t minVruntime;
+  int targetLatency;
+  int minGranularity;
+  // number of jobs in the tree or running
+  int runnable;
+  int running;
+  int runningSince;
+} Fair;
+
+typedef struct {
+  int quantum;
+  // number of times jobs entered the level
+  int entered;
+  // total time jobs spent at the level, queued or running
+  int64_t residency;
+  // total time jobs ran at the level
+  int64_t runTime;
+} MLFQLevel;
+
+// MLFQ: jobs arrive at the top level and run round robin within the highest
+// non-empty level, preempting jobs of lower levels. A job that has used up
+// the quantum of its level, over however many turns, moves down a level,
+// and every boost period all jobs move back to the top level. The default
+// levels have quanta of quantum, 2 * quantum, 4 * quantum and so on.
+typedef struct {
+  int levels;
+  MLFQLevel stats[MLFQ_MAX_LEVELS];
+  JobRing queues[MLFQ_MAX_LEVELS];
+  // bit i is set if queues[i] is not empty
+  uint32_t nonEmpty;
+  int* level;
+  // time used of the quantum at the current level
+  int* used;
+  // when the job entered its current level
+  int* enteredAt;
+  int boostPeriod;
+  // time of the next boost, -1 before the first arrival
+  int nextBoost;
+  int boosts;
+  int running;
+  int runningSince;
+} MLFQ;
+
+// node of the EDF admission tree, covering a range of jobs in order of
+// deadline
+typedef struct {
+  // remaining time of the admitted jobs in the range
+  int64_t work;
+  // least slack of an admitted job in the range: its deadline minus the
+  // remaining time of the admitted jobs in the range up to and including it
+  int64_t slack;
+} EDFNode;
+
+// EDF: the job with the earliest deadline runs first, and an arriving job
+// preempts the running job if its deadline is earlier. With admission
+// control a job is only admitted if, running in order of deadline, every
+// admitted job would still finish by its deadline; rejected jobs run as if
+// they had no deadline. Deadline misses, lateness and tardiness are counted
+// over the admitted jobs.
+typedef struct {
+  const PolicyJob* jobs;
+  JobHeap heap;
+  int64_t* key;
+  // with admission control, a segment tree whose leaves, from size on, are
+  // the jobs with a deadline in order of deadline
+  EDFNode* tree;
+  int size;
+  int* leaf;
+  // remaining time of each job as of its last update in the tree
+  int* treeWork;
+  int running;
+  int deadlines;
+  int rejected;
+  int missed;
+  int64_t minLateness;
+  int64_t maxLateness;
+  double latenessSum;
+  Histogram tardiness;
+} EDF;
+
+// Tracks how far the service of each job strays from its weighted share.
+// While runnable, a job is owed its weight over the total weight of the
+// runnable jobs of every unit of time, so its target service is its weight
+// times the growth since it arrived of share time, which advances by one
+// over the total weight per unit of time.
+typedef struct {
+  const PolicyJob* jobs;
+  int n;
+  double shareTime;
+  int lastTime;
+  int64_t totalWeight;
+  // share time when each job arrived
+  double* arrivedAt;
+  int64_t* service;
+  // most each job got ahead of and fell behind its target service
+  double* ahead;
+  double* behind;
+} Shares;
+
+// Stride: every job has a pass that advances by its stride, inversely
+// proportional to its weight, for every unit of time it runs, and the job
+// with the smallest pass runs next for a quantum. Arriving jobs start at the
+// largest pass picked so far, so they cannot claim the time before they
+// arrived.
+typedef struct {
+  Shares shares;
+  JobHeap heap;
+  int64_t* pass;
+  int64_t maxPass;
+  int quantum;
+  int running;
+  int runningSince;
+} Stride;
+
+// Lottery: every quantum the job to run is drawn from the runnable jobs
+// with a probability proportional to its weight, using a Fenwick tree of
+// the weights of the waiting jobs.
+typedef struct {
+  Shares shares;
+  // tree[i] is the total weight of jobs i - (i & -i) to i - 1
+  int64_t* tree;
+  int n;
+  // largest power of two not above n
+  int top;
+  int64_t total;
+  uint64_t random;
+  int quantum;
+  int running;
+  int runningSince;
+} Lottery;
+
+static inline void* FIFOCreate(const PolicyJob* jobs, int n,
+                               const PolicyParams* params) {
+  ArrivalOrder* state = malloc(sizeof(ArrivalOrder));
+  if (!state) abort();
+  JobRingInit(&state->ring);
+  state->slice = POLICY_NO_SLICE;
+  return state;
+}
+
+static inline void* RRCreate(const PolicyJob* jobs, int n,
+                             const PolicyParams* params) {
+  ArrivalOrder* state = FIFOCreate(jobs, n, params);
+  state->slice = params->quantum;
+  return state;
+}
+
+static inline void ArrivalOrderDestroy(void* state) {
+  JobRingFree(&((ArrivalOrder*)state)->ring);
+  free(state);
+}
+
+static inline bool ArrivalOrderOnArrival(void* state, int job, int time) {
+  JobRingPush(&((ArrivalOrder*)state)->ring, job);
+  return false;
+}
+
+static inline int ArrivalOrderPickNext(void* state, int time, int* slice) {
+  ArrivalOrder* order = state;
+  if (order->ring.size == 0)
+    return -1;
+  *slice = order->slice;
+  return JobRingPop(&order->ring);
+}
+
+static inline void ArrivalOrderOnPreempt(void* state, int job, int time) {
+  JobRingPush(&((ArrivalOrder*)state)->ring, job);
+}
+
+static inline void* ShortestFirstCreate(const PolicyJob* jobs, int n,
+                                        const PolicyParams* params) {
+  ShortestFirst* state = malloc(sizeof(ShortestFirst));
+  if (!state) abort();
+  state->jobs = jobs;
+  JobHeapInit(&state->heap);
+  return state;
+}
+
+static inline void ShortestFirstDestroy(void* state) {
+  JobHeapFree(&((ShortestFirst*)state)->heap);
+  free(state);
+}
+
+static inline bool SJFOnArrival(void* state, int job, int time) {
+  ShortestFirst* shortest = state;
+  JobHeapPush(&shortest->heap, job, shortest->jobs[job].execTime);
+  return false;
+}
+
+static inline bool PSJFOnArrival(void* state, int job, int time) {
+  SJFOnArrival(state, job, time);
+  return true;
+}
+
+static inline int ShortestFirstPickNext(void* state, int time, int* slice) {
+  ShortestFirst* shortest = state;
+  if (shortest->heap.size == 0)
+    return -1;
+  *slice = POLICY_NO_SLICE;
+  return JobHeapPop(&shortest->heap);
+}
+
+static inline void ShortestFirstOnPreempt(void* state, int job, int time) {
+  SJFOnArrival(state, job, time);
+}
+
+static inline void* CFSCreate(const PolicyJob* jobs, int n,
+                              const PolicyParams* params) {
+  Fair* state = malloc(sizeof(Fair));
+  if (!state) abort();
+  JobTreeInit(&state->tree, n);
+  state->vruntime = calloc(n, sizeof(int64_t));
+  if (!state->vruntime) abort();
+  state->minVruntime = 0;
+  state->targetLatency = params->targetLatency;
+  state->minGranularity = params->minGranularity;
+  state->runnable = 0;
+  state->running = -1;
+  return state;
+}
+
+static inline void CFSDestroy(void* state) {
+  Fair* fair = state;
+  JobTreeFree(&fair->tree);
+  free(fair->vruntime);
+  free(fair);
+}
+
+// advances minVruntime to the smaller of the running job's virtual runtime
+// so far and the first queued job's, as update_min_vruntime does in Linux
+static inline void CFSUpdateMinVruntime(Fair* fair, int time) {
+  int64_t vruntime = INT64_MAX;
+  if (fair->running != -1)
+    vruntime = fair->vruntime[fair->running] + (time - fair->runningSince);
+  int first = JobTreeFirst(&fair->tree);
+  if (first != -1 && fair->vruntime[first] < vruntime)
+    vruntime = fair->vruntime[first];
+  if (vruntime != INT64_MAX && vruntime > fair->minVruntime)
+    fair->minVruntime = vruntime;
+}
+
+static inline bool CFSOnArrival(void* state, int job, int time) {
+  Fair* fair = state;
+  CFSUpdateMinVruntime(fair, time);
+  fair->vruntime[job] = fair->minVruntime;
+  JobTreeInsert(&fair->tree, job, fair->vruntime[job]);
+  ++fair->runnable;
+  return fair->running != -1 &&
+         fair->vruntime[fair->running] + (time - fair->runningSince) -
+         fair->vruntime[job] > fair->minGranularity;
+}
+
+static inline int CFSPickNext(void* state, int time, int* slice) {
+  Fair* fair = state;
+  int job = JobTreeFirst(&fair->tree);
+  if (job == -1)
+    return -1;
+  JobTreeRemove(&fair->tree, job);
+  fair->running = job;
+  fair->runningSince = time;
+  CFSUpdateMinVruntime(fair, time);
+  *slice = fair->targetLatency / fair->runnable;
+  if (*slice < fair->minGranularity)
+    *slice = fair->minGranularity;
+  return job;
+}
+
+static inline void CFSOnPreempt(void* state, int job, int time) {
+  Fair* fair = state;
+  fair->vruntime[job] += time - fair->runningSince;
+  JobTreeInsert(&fair->tree, job, fair->vruntime[job]);
+  fair->running = -1;
+  CFSUpdateMinVruntime(fair, time);
+}
+
+static inline void CFSOnFinish(void* state, int job, int time) {
+  Fair* fair = state;
+  --fair->runnable;
+  fair->running = -1;
+}
+
+// parses a comma-separated list of MLFQ quanta, one for each level
+static inline bool MLFQParseQuanta(const char* list, int* quanta,
+                                   int* levels) {
+  *levels = 0;
+  for (const char* p = list; *p;) {
+    char* end;
+    long quantum = strtol(p, &end, 10);
+    if (end == p || quantum < 1 || quantum > INT32_MAX ||
+        *levels == MLFQ_MAX_LEVELS)
+      return false;
+    quanta[(*levels)++] = quantum;
+    if (*end == ',')
+      ++end;
+    else if (*end != '\0')
+      return false;
+    p = end;
+  }
+  return *levels > 0;
+}
+
+static inline void* MLFQCreate(const PolicyJob* jobs, int n,
+                               const PolicyParams* params) {
+  MLFQ* state = calloc(1, sizeof(MLFQ));
+  if (!state) abort();
+  state->levels = params->levels > 0 ? params->levels : DEFAULT_MLFQ_LEVELS;
+  for (int i = 0; i < state->levels; ++i) {
+    state->stats[i].quantum = params->levels > 0 ? params->levelQuanta[i] :
+                                                   params->quantum << i;
+    JobRingInit(&state->queues[i]);
+  }
+  state->level = malloc(sizeof(int) * n);
+  state->used = malloc(sizeof(int) * n);
+  state->enteredAt = malloc(sizeof(int) * n);
+  if (!state->level || !state->used || !state->enteredAt) abort();
+  state->boostPeriod = params->boostPeriod;
+  state->nextBoost = -1;
+  state->running = -1;
+  return state;
+}
+
+static inline void MLFQDestroy(void* state) {
+  MLFQ* mlfq = state;
+  for (int i = 0; i < mlfq->levels; ++i)
+    JobRingFree(&mlfq->queues[i]);
+  free(mlfq->level);
+  free(mlfq->used);
+  free(mlfq->enteredAt);
+  free(mlfq);
+}
+
+static inline void MLFQEnter(MLFQ* mlfq, int job, int level, int time) {
+  mlfq->level[job] = level;
+  mlfq->used[job] = 0;
+  mlfq->enteredAt[job] = time;
+  ++mlfq->stats[level].entered;
+}
+
+static inline void MLFQLeave(MLFQ* mlfq, int job, int time) {
+  mlfq->stats[mlfq->level[job]].residency += time - mlfq->enteredAt[job];
+}
+
+static inline void MLFQPush(MLFQ* mlfq, int job) {
+  JobRingPush(&mlfq->queues[mlfq->level[job]], job);
+  mlfq->nonEmpty |= 1u << mlfq->level[job];
+}
+
+// accounts for the time the running job ran since it was picked
+static inline void MLFQStop(MLFQ* mlfq, int time) {
+  int job = mlfq->running;
+  mlfq->stats[mlfq->level[job]].runTime += time - mlfq->runningSince;
+  mlfq->used[job] += time - mlfq->runningSince;
+  mlfq->runningSince = time;
+}
+
+static inline bool MLFQOnArrival(void* state, int job, int time) {
+  MLFQ* mlfq = state;
+  if (mlfq->nextBoost == -1)
+    mlfq->nextBoost = time + mlfq->boostPeriod;
+  MLFQEnter(mlfq, job, 0, time);
+  MLFQPush(mlfq, job);
+  return mlfq->running != -1 && mlfq->level[mlfq->running] > 0;
+}
+
+static inline void MLFQOnEvent(void* state, int time) {
+  MLFQ* mlfq = state;
+  if (mlfq->nextBoost == -1 || time < mlfq->nextBoost)
+    return;
+  mlfq->nextBoost += ((time - mlfq->nextBoost) / mlfq->boostPeriod + 1) *
+                     mlfq->boostPeriod;
+  ++mlfq->boosts;
+  for (int i = 1; i < mlfq->levels; ++i) {
+    while (mlfq->queues[i].size > 0) {
+      int job = JobRingPop(&mlfq->queues[i]);
+      MLFQLeave(mlfq, job, time);
+      MLFQEnter(mlfq, job, 0, time);
+      MLFQPush(mlfq, job);
+    }
+  }
+  mlfq->nonEmpty &= 1;
+  if (mlfq->running != -1 && mlfq->level[mlfq->running] > 0) {
+    MLFQStop(mlfq, time);
+    MLFQLeave(mlfq, mlfq->running, time);
+    MLFQEnter(mlfq, mlfq->running, 0, time);
+  }
+}
+
+static inline int MLFQPickNext(void* state, int time, int* slice) {
+  MLFQ* mlfq = state;
+  if (!mlfq->nonEmpty)
+    return -1;
+  int level = __builtin_ctz(mlfq->nonEmpty);
+  int job = JobRingPop(&mlfq->queues[level]);
+  if (mlfq->queues[level].size == 0)
+    mlfq->nonEmpty &= ~(1u << level);
+  mlfq->running = job;
+  mlfq->runningSince = time;
+  *slice = mlfq->stats[level].quantum - mlfq->used[job];
+  // make sure the driver comes back at the next boost
+  if (mlfq->levels > 1 && mlfq->nextBoost - time < *slice)
+    *slice = mlfq->nextBoost - time;
+  return job;
+}
+
+static inline void MLFQOnPreempt(void* state, int job, int time) {
+  MLFQ* mlfq = state;
+  MLFQStop(mlfq, time);
+  int level = mlfq->level[job];
+  if (mlfq->used[job] >= mlfq->stats[level].quantum) {
+    if (level < mlfq->levels - 1) {
+      MLFQLeave(mlfq, job, time);
+      MLFQEnter(mlfq, job, level + 1, time);
+    } else {
+      mlfq->used[job] = 0;
+    }
+  }
+  MLFQPush(mlfq, job);
+  mlfq->running = -1;
+}
+
+static inline void MLFQOnFinish(void* state, int job, int time) {
+  MLFQ* mlfq = state;
+  MLFQStop(mlfq, time);
+  MLFQLeave(mlfq, job, time);
+  mlfq->running = -1;
+}
+
+static inline void MLFQReport(void* state, FILE* out) {
+  MLFQ* mlfq = state;
+  fprintf(out, "levels:\n");
+  for (int i = 0; i < mlfq->levels; ++i) {
+    fprintf(out, "level %d: quantum %d, entered %d, residency %lld, "
+                 "run %lld\n", i, mlfq->stats[i].quantum,
+            mlfq->stats[i].entered, (long long)mlfq->stats[i].residency,
+            (long long)mlfq->stats[i].runTime);
+  }
+  fprintf(out, "boosts: %d\n", mlfq->boosts);
+}
+
+static inline void SharesInit(Shares* shares, const PolicyJob* jobs, int n) {
+  shares->jobs = jobs;
+  shares->n = n;
+  shares->shareTime = 0;
+  shares->lastTime = 0;
+  shares->totalWeight = 0;
+  shares->arrivedAt = malloc(sizeof(double) * n);
+  shares->service = calloc(n, sizeof(int64_t));
+  shares->ahead = calloc(n, sizeof(double));
+  shares->behind = calloc(n, sizeof(double));
+  if (!shares->arrivedAt || !shares->service || !shares->ahead ||
+      !shares->behind) abort();
+}
+
+static inline void SharesFree(Shares* shares) {
+  free(shares->arrivedAt);
+  free(shares->service);
+  free(shares->ahead);
+  free(shares->behind);
+}
+
+// called before anything else at every event
+static inline void SharesAdvance(Shares* shares, int time) {
+  if (shares->totalWeight > 0)
+    shares->shareTime += (double)(time - shares->lastTime) /
+                         shares->totalWeight;
+  shares->lastTime = time;
+}
+
+static inline void SharesArrive(Shares* shares, int job) {
+  shares->arrivedAt[job] = shares->shareTime;
+  shares->totalWeight += shares->jobs[job].weight;
+}
+
+// compares the service of the job with its target; the difference changes
+// linearly between events and only in one direction while the job runs or
+// waits, so checking when it is picked and when it stops finds the extremes
+static inline void SharesCheck(Shares* shares, int job) {
+  double deviation = shares->service[job] - shares->jobs[job].weight *
+                     (shares->shareTime - shares->arrivedAt[job]);
+  if (deviation > shares->ahead[job]) shares->ahead[job] = deviation;
+  if (-deviation > shares->behind[job]) shares->behind[job] = -deviation;
+}
+
+static inline void SharesRan(Shares* shares, int job, int time) {
+  shares->service[job] += time;
+  SharesCheck(shares, job);
+}
+
+static inline void SharesLeave(Shares* shares, int job) {
+  shares->totalWeight -= shares->jobs[job].weight;
+}
+
+static inline void SharesReport(const Shares* shares, FILE* out) {
+  Histogram* histogram = malloc(sizeof(Histogram));
+  if (!histogram) abort();
+  HistogramInit(histogram);
+  int behindJob = 0;
+  int aheadJob = 0;
+  for (int i = 0; i < shares->n; ++i) {
+    double deviation = shares->ahead[i] > shares->behind[i] ?
+                       shares->ahead[i] : shares->behind[i];
+    HistogramRecord(histogram, deviation + 0.5);
+    if (shares->behind[i] > shares->behind[behindJob]) behindJob = i;
+    if (shares->ahead[i] > shares->ahead[aheadJob]) aheadJob = i;
+  }
+  static const double percentiles[] = { 50, 90, 99, 99.9 };
+  fprintf(out, "shares:\n");
+  fprintf(out, "deviation: mean %.3f", HistogramMean(histogram));
+  for (int i = 0; i < sizeof(percentiles) / sizeof(double); ++i) {
+    fprintf(out, ", p%g %lld", percentiles[i],
+            (long long)HistogramPercentile(histogram, percentiles[i]));
+  }
+  fprintf(out, ", max %lld\n", (long long)histogram->max);
+  fprintf(out, "most behind: %s, weight %d, %.3f\n",
+          shares->jobs[behindJob].name, shares->jobs[behindJob].weight,
+          shares->behind[behindJob]);
+  fprintf(out, "most ahead: %s, weight %d, %.3f\n",
+          shares->jobs[aheadJob].name, shares->jobs[aheadJob].weight,
+          shares->ahead[aheadJob]);
+  free(histogram);
+}
+
+static inline void* StrideCreate(const PolicyJob* jobs, int n,
+                                 const PolicyParams* params) {
+  Stride* state = malloc(sizeof(Stride));
+  if (!state) abort();
+  SharesInit(&state->shares, jobs, n);
+  JobHeapInit(&state->heap);
+  state->pass = malloc(sizeof(int64_t) * n);
+  if (!state->pass) abort();
+  state->maxPass = 0;
+  state->quantum = params->quantum;
+  state->running = -1;
+  return state;
+}
+
+static inline void StrideDestroy(void* state) {
+  Stride* stride = state;
+  SharesFree(&stride->shares);
+  JobHeapFree(&stride->heap);
+  free(stride->pass);
+  free(stride);
+}
+
+static inline bool StrideOnArrival(void* state, int job, int time) {
+  Stride* stride = state;
+  SharesAdvance(&stride->shares, time);
+  SharesArrive(&stride->shares, job);
+  stride->pass[job] = stride->maxPass;
+  JobHeapPush(&stride->heap, job, stride->pass[job]);
+  return false;
+}
+
+static inline int StridePickNext(void* state, int time, int* slice) {
+  Stride* stride = state;
+  if (stride->heap.size == 0)
+    return -1;
+  SharesAdvance(&stride->shares, time);
+  int job = JobHeapPop(&stride->heap);
+  SharesCheck(&stride->shares, job);
+  if (stride->pass[job] > stride->maxPass)
+    stride->maxPass = stride->pass[job];
+  stride->running = job;
+  stride->runningSince = time;
+  *slice = stride->quantum;
+  return job;
+}
+
+// accounts for the time the running job ran since it was picked
+static inline void StrideStop(Stride* stride, int time) {
+  int job = stride->running;
+  SharesAdvance(&stride->shares, time);
+  SharesRan(&stride->shares, job, time - stride->runningSince);
+  stride->pass[job] += (int64_t)(time - stride->runningSince) *
+                       (STRIDE_ONE / stride->shares.jobs[job].weight);
+  stride->running = -1;
+}
+
+static inline void StrideOnPreempt(void* state, int job, int time) {
+  Stride* stride = state;
+  StrideStop(stride, time);
+  JobHeapPush(&stride->heap, job, stride->pass[job]);
+}
+
+static inline void StrideOnFinish(void* state, int job, int time) {
+  Stride* stride = state;
+  StrideStop(stride, time);
+  SharesLeave(&stride->shares, job);
+}
+
+static inline void StrideReport(void* state, FILE* out) {
+  SharesReport(&((Stride*)state)->shares, out);
+}
+
+static inline void* LotteryCreate(const PolicyJob* jobs, int n,
+                                  const PolicyParams* params) {
+  Lottery* state = malloc(sizeof(Lottery));
+  if (!state) abort();
+  SharesInit(&state->shares, jobs, n);
+  state->tree = calloc(n + 1, sizeof(int64_t));
+  if (!state->tree) abort();
+  state->n = n;
+  for (state->top = 1; state->top <= n / 2; state->top *= 2);
+  state->total = 0;
+  state->random = params->seed ? params->seed : LOTTERY_SEED;
+  state->quantum = params->quantum;
+  state->running = -1;
+  return state;
+}
+
+static inline void LotteryDestroy(void* state) {
+  Lottery* lottery = state;
+  SharesFree(&lottery->shares);
+  free(lottery->tree);
+  free(lottery);
+}
+
+static inline void LotteryAdd(Lottery* lottery, int job, int64_t weight) {
+  lottery->total += weight;
+  for (int i = job + 1; i <= lottery->n; i += i & -i)
+    lottery->tree[i] += weight;
+}
+
+// xorshift64*
+static inline uint64_t LotteryRandom(Lottery* lottery) {
+  uint64_t x = lottery->random;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  lottery->random = x;
+  return x * 0x2545f4914f6cdd1dull;
+}
+
+static inline bool LotteryOnArrival(void* state, int job, int time) {
+  Lottery* lottery = state;
+  SharesAdvance(&lottery->shares, time);
+  SharesArrive(&lottery->shares, job);
+  LotteryAdd(lottery, job, lottery->shares.jobs[job].weight);
+  return false;
+}
+
+static inline int LotteryPickNext(void* state, int time, int* slice) {
+  Lottery* lottery = state;
+  if (lottery->total == 0)
+    return -1;
+  SharesAdvance(&lottery->shares, time);
+  // find the job whose range of tickets holds the winning ticket
+  int64_t ticket = LotteryRandom(lottery) % lottery->total;
+  int job = 0;
+  for (int step = lottery->top; step > 0; step /= 2) {
+    if (job + step <= lottery->n && lottery->tree[job + step] <= ticket) {
+      job += step;
+      ticket -= lottery->tree[job];
+    }
+  }
+  LotteryAdd(lottery, job, -lottery->shares.jobs[job].weight);
+  SharesCheck(&lottery->shares, job);
+  lottery->running = job;
+  lottery->runningSince = time;
+  *slice = lottery->quantum;
+  return job;
+}
+
+static inline void LotteryOnPreempt(void* state, int job, int time) {
+  Lottery* lottery = state;
+  SharesAdvance(&lottery->shares, time);
+  SharesRan(&lottery->shares, job, time - lottery->runningSince);
+  LotteryAdd(lottery, job, lottery->shares.jobs[job].weight);
+  lottery->running = -1;
+}
+
+static inline void LotteryOnFinish(void* state, int job, int time) {
+  Lottery* lottery = state;
+  SharesAdvance(&lottery->shares, time);
+  SharesRan(&lottery->shares, job, time - lottery->runningSince);
+  SharesLeave(&lottery->shares, job);
+  lottery->running = -1;
+}
+
+static inline void LotteryReport(void* state, FILE* out) {
+  SharesReport(&((Lottery*)state)->shares, out);
+}
+
+static inline int EDFEntryCmp(const void* pa, const void* pb) {
+  return JobHeapLess(pa, pb) ? -1 : JobHeapLess(pb, pa);
+}
+
+static inline void* EDFCreate(const PolicyJob* jobs, int n,
+                              const PolicyParams* params) {
+  EDF* state = calloc(1, sizeof(EDF));
+  if (!state) abort();
+  state->jobs = jobs;
+  JobHeapInit(&state->heap);
+  state->key = malloc(sizeof(int64_t) * n);
+  if (!state->key) abort();
+  state->running = -1;
+  state->minLateness = INT64_MAX;
+  state->maxLateness = INT64_MIN;
+  HistogramInit(&state->tardiness);
+  if (!params->admission)
+    return state;
+
+  // order the jobs with a deadline the same way as the heap does
+  JobHeapEntry* order = malloc(sizeof(JobHeapEntry) * n);
+  state->leaf = malloc(sizeof(int) * n);
+  state->treeWork = calloc(n, sizeof(int));
+  if (!order || !state->leaf || !state->treeWork) abort();
+  int count = 0;
+  for (int i = 0; i < n; ++i) {
+    if (jobs[i].deadline != POLICY_NO_DEADLINE)
+      order[count++] = (JobHeapEntry){ jobs[i].deadline, i };
+  }
+  qsort(order, count, sizeof(JobHeapEntry), EDFEntryCmp);
+  for (state->size = 1; state->size < count; state->size *= 2);
+  state->tree = malloc(sizeof(EDFNode) * 2 * state->size);
+  if (!state->tree) abort();
+  for (int i = 0; i < 2 * state->size; ++i)
+    state->tree[i] = (EDFNode){ 0, INT64_MAX };
+  for (int i = 0; i < count; ++i)
+    state->leaf[order[i].job] = state->size + i;
+  free(order);
+  return state;
+}
+
+static inline void EDFDestroy(void* state) {
+  EDF* edf = state;
+  JobHeapFree(&edf->heap);
+  free(edf->key);
+  free(edf->tree);
+  free(edf->leaf);
+  free(edf->treeWork);
+  free(edf);
+}
+
+// sets the remaining time of an admitted job in the admission tree, 0 to
+// remove it
+static inline void EDFUpdate(EDF* edf, int job, int work) {
+  edf->treeWork[job] = work;
+  int i = edf->leaf[job];
+  edf->tree[i].work = work;
+  edf->tree[i].slack = work > 0 ? edf->jobs[job].deadline - work : INT64_MAX;
+  for (i /= 2; i > 0; i /= 2) {
+    const EDFNode* left = &edf->tree[2 * i];
+    const EDFNode* right = &edf->tree[2 * i + 1];
+    edf->tree[i].work = left->work + right->work;
+    edf->tree[i].slack = right->slack == INT64_MAX ?
+                         left->slack : right->slack - left->work;
+    if (left->slack < edf->tree[i].slack)
+      edf->tree[i].slack = left->slack;
+  }
+}
+
+// brings the remaining time of the running job up to date in the admission
+// tree
+static inline void EDFSync(EDF* edf) {
+  int job = edf->running;
+  if (edf->tree && job != -1 && edf->key[job] != EDF_BEST_EFFORT &&
+      edf->treeWork[job] != edf->jobs[job].execTime)
+    EDFUpdate(edf, job, edf->jobs[job].execTime);
+}
+
+static inline bool EDFOnArrival(void* state, int job, int time) {
+  EDF* edf = state;
+  EDFSync(edf);
+  edf->key[job] = EDF_BEST_EFFORT;
+  if (edf->jobs[job].deadline != POLICY_NO_DEADLINE) {
+    ++edf->deadlines;
+    edf->key[job] = edf->jobs[job].deadline;
+    if (edf->tree) {
+      EDFUpdate(edf, job, edf->jobs[job].execTime);
+      if (edf->tree[1].slack < time || edf->jobs[job].deadline < time) {
+        EDFUpdate(edf, job, 0);
+        edf->key[job] = EDF_BEST_EFFORT;
+        ++edf->rejected;
+      }
+    }
+  }
+  JobHeapPush(&edf->heap, job, edf->key[job]);
+  return edf->running != -1 && edf->key[job] < edf->key[edf->running];
+}
+
+static inline int EDFPickNext(void* state, int time, int* slice) {
+  EDF* edf = state;
+  if (edf->heap.size == 0)
+    return -1;
+  *slice = POLICY_NO_SLICE;
+  return edf->running = JobHeapPop(&edf->heap);
+}
+
+static inline void EDFOnPreempt(void* state, int job, int time) {
+  EDF* edf = state;
+  EDFSync(edf);
+  JobHeapPush(&edf->heap, job, edf->key[job]);
+  edf->running = -1;
+}
+
+static inline void EDFOnFinish(void* state, int job, int time) {
+  EDF* edf = state;
+  EDFSync(edf);
+  edf->running = -1;
+  if (edf->key[job] == EDF_BEST_EFFORT)
+    return;
+  int64_t lateness = (int64_t)time - edf->jobs[job].deadline;
+  edf->missed += lateness > 0;
+  edf->latenessSum += lateness;
+  if (lateness < edf->minLateness) edf->minLateness = lateness;
+  if (lateness > edf->maxLateness) edf->maxLateness = lateness;
+  // tardiness is the lateness of a job that missed its deadline and 0 for
+  // one that met it
+  HistogramRecord(&edf->tardiness, lateness > 0 ? lateness : 0);
+}
+
+static inline void EDFReport(void* state, FILE* out) {
+  EDF* edf = state;
+  fprintf(out, "deadlines:\n");
+  fprintf(out, "jobs: %d, rejected %d, missed %d\n", edf->deadlines,
+          edf->rejected, edf->missed);
+  const Histogram* tardiness = &edf->tardiness;
+  if (tardiness->count == 0)
+    return;
+  fprintf(out, "lateness: mean %.3f, min %lld, max %lld\n",
+          edf->latenessSum / tardiness->count, (long long)edf->minLateness,
+          (long long)edf->maxLateness);
+  static const double percentiles[] = { 50, 90, 99, 99.9 };
+  fprintf(out, "tardiness: mean %.3f", HistogramMean(tardiness));
+  for (int i = 0; i < sizeof(percentiles) / sizeof(double); ++i) {
+    fprintf(out, ", p%g %lld", percentiles[i],
+            (long long)HistogramPercentile(tardiness, percentiles[i]));
+  }
+  fprintf(out, ", max %lld\n", (long long)tardiness->max);
+}
+
+static const Policy policyFIFO = {
+  POLICY_VERSION, "FIFO", FIFOCreate, ArrivalOrderDestroy,
+  ArrivalOrderOnArrival, NULL, ArrivalOrderPickNext, ArrivalOrderOnPreempt,
+  NULL, NULL
+};
+static const Policy policyRR = {
+  POLICY_VERSION, "RR", RRCreate, ArrivalOrderDestroy, ArrivalOrderOnArrival,
+  NULL, ArrivalOrderPickNext, ArrivalOrderOnPreempt, NULL, NULL
+};
+static const Policy policySJF = {
+  POLICY_VERSION, "SJF", ShortestFirstCreate, ShortestFirstDestroy,
+  SJFOnArrival, NULL, ShortestFirstPickNext, ShortestFirstOnPreempt, NULL,
+  NULL
+};
+static const Policy policyPSJF = {
+  POLICY_VERSION, "PSJF", ShortestFirstCreate, ShortestFirstDestroy,
+  PSJFOnArrival, NULL, ShortestFirstPickNext, ShortestFirstOnPreempt, NULL,
+  NULL
+};
+static const Policy policyCFS = {
+  POLICY_VERSION, "CFS", CFSCreate, CFSDestroy, CFSOnArrival, NULL,
+  CFSPickNext, CFSOnPreempt, CFSOnFinish, NULL
+};
+static const Policy policyMLFQ = {
+  POLICY_VERSION, "MLFQ", MLFQCreate, MLFQDestroy, MLFQOnArrival, MLFQOnEvent,
+  MLFQPickNext, MLFQOnPreempt, MLFQOnFinish, MLFQReport
+};
+
+static const Policy policyEDF = {
+  POLICY_VERSION, "EDF", EDFCreate, EDFDestroy, EDFOnArrival, NULL,
+  EDFPickNext, EDFOnPreempt, EDFOnFinish, EDFReport
+};
+
+static const Policy policyStride = {
+  POLICY_VERSION, "STRIDE", StrideCreate, StrideDestroy, StrideOnArrival,
+  NULL, StridePickNext, StrideOnPreempt, StrideOnFinish, StrideReport
+};
+static const Policy policyLottery = {
+  POLICY_VERSION, "LOTTERY", LotteryCreate, LotteryDestroy, LotteryOnArrival,
+  NULL, LotteryPickNext, LotteryOnPreempt, LotteryOnFinish, LotteryReport
+};
+
+static const Policy* const builtinPolicies[] = {
+  &policyFIFO, &policyRR, &policySJF, &policyPSJF, &policyCFS,
+  &policyMLFQ, &policyEDF, &policyStride, &policyLottery, NULL
+};
+
+static const Policy* policyPlugins[POLICY_MAX_PLUGINS];
+static int policyPluginCount;
+
+// loads a policy plugin, reporting failures to stderr; plugins take
+// precedence over built-in policies of the same name
+static inline const Policy* PolicyLoad(const char* path) {
+  void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (!handle) {
+    fprintf(stderr, "%s\n", dlerror());
+    return NULL;
+  }
+  const Policy* policy = dlsym(handle, POLICY_SYMBOL);
+  if (!policy) {
+    fprintf(stderr, "%s\n", dlerror());
+  } else if (policy->version != POLICY_VERSION || !policy->name ||
+             !policy->create || !policy->destroy || !policy->onArrival ||
+             !policy->pickNext || !policy->onPreempt) {
+    fprintf(stderr, "%s: incompatible policy\n", path);
+  } else if (policyPluginCount == POLICY_MAX_PLUGINS) {
+    fprintf(stderr, "%s: too many policies\n", path);
+  } else {
+    return policyPlugins[policyPluginCount++] = policy;
+  }
+  dlclose(handle);
+  return NULL;
+}
+
+static inline const Policy* PolicyFind(const char* name) {
+  for (int i = policyPluginCount - 1; i >= 0; --i) {
+    if (strcmp(policyPlugins[i]->name, name) == 0)
+      return policyPlugins[i];
+  }
+  for (int i = 0; builtinPolicies[i]; ++i) {
+    if (strcmp(builtinPolicies[i]->name, name) == 0)
+      return builtinPolicies[i];
+  }
+  return NULL;
+}
+
+#endif
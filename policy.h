@@ -0,0 +1,406 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Scheduling policies are driven through the same interface by the
+// simulator and by the real scheduler, which both run one job at a time.
+// At every event (an arrival, a completion or the end of a time slice) the
+// driver calls onFinish if the running job completed, onArrival for each
+// job that became ready, onEvent, onPreempt for the running job if its time
+// slice ended or onArrival asked for it, and finally pickNext if no job is
+// running.
+// Jobs are identified by their index into the jobs array given to create,
+// which is sorted by ready time, then by input order. The driver keeps the
+// remaining execution time of every job up to date before each call.
+// Jobs may have a deadline, an absolute time by which they should finish,
+// and a weight, their share of the cpu relative to the other jobs.
+// Policies that keep statistics print them from report at the end of a run.
+//
+// Policies can also be built as shared objects that include this header and
+// define a Policy named by POLICY_SYMBOL (see policies.h for how they are
+// loaded).
+
+#define POLICY_VERSION 5
+#define POLICY_SYMBOL "policyPlugin"
+// pickNext leaves the job running until it completes or is preempted by an
+// arrival
+#define POLICY_NO_SLICE INT32_MAX
+// deadline of jobs that have none
+#define POLICY_NO_DEADLINE INT32_MAX
+
+typedef struct {
+  // name given by the workload, for reports
+  const char* name;
+  int readyTime;
+  // execution time given by the workload
+  int burstTime;
+  // remaining execution time
+  int execTime;
+  int deadline;
+  // at least 1
+  int weight;
+} PolicyJob;
+
+typedef struct {
+  // length of a round robin time slice
+  int quantum;
+  // period in which every runnable job should run once with CFS
+  int targetLatency;
+  // shortest time slice with CFS
+  int minGranularity;
+  // number of MLFQ levels and the quantum of each, 0 for the default
+  int levels;
+  const int* levelQuanta;
+  // period after which MLFQ moves every job back to the top level
+  int boostPeriod;
+  // admit a job with a deadline to EDF only if every admitted job can still
+  // finish by its deadline
+  bool admission;
+  // seed of the draws of the lottery, 0 for the default
+  uint64_t seed;
+} PolicyParams;
+
+typedef struct {
+  int version;
+  // matched against the policy given by the workload
+  const char* name;
+  // returns the state passed to the other calls
+  void* (*create)(const PolicyJob* jobs, int n, const PolicyParams* params);
+  void (*destroy)(void* state);
+  // returns true if the running job should be preempted
+  bool (*onArrival)(void* state, int job, int time);
+  // may be NULL
+  void (*onEvent)(void* state, int time);
+  // returns the job to run next, or -1 if there is none, and sets *slice to
+  // how long it may run before it is preempted
+  int (*pickNext)(void* state, int time, int* slice);
+  void (*onPreempt)(void* state, int job, int time);
+  // may be NULL
+  void (*onFinish)(void* state, int job, int time);
+  // may be NULL
+  void (*report)(void* state, FILE* out);
+} Policy;
+
+// fills jobs from an array of structures with name, readyTime, execTime,
+// deadline and weight members, such as the Process of each driver, which
+// must outlive the jobs
+#define POLICY_JOBS_INIT(jobs, processes, n) {                                 \
+          for (int i_ = 0; i_ < (n); ++i_) {                                   \
+            (jobs)[i_].name = (processes)[i_].name;                            \
+            (jobs)[i_].readyTime = (processes)[i_].readyTime;                  \
+            (jobs)[i_].burstTime = (jobs)[i_].execTime =                       \
+              (processes)[i_].execTime;                                        \
+            (jobs)[i_].deadline = (processes)[i_].deadline;                    \
+            (jobs)[i_].weight = (processes)[i_].weight;                        \
+          }                                                                    \
+        }
+
+// Containers shared by the policies.
+
+typedef struct {
+  int64_t key;
+  int job;
+} JobHeapEntry;
+
+// min-heap of jobs ordered by key, with ties broken by job index
+typedef struct {
+  JobHeapEntry* entries;
+  int size;
+  int capacity;
+} JobHeap;
+
+// double-ended queue of jobs in a ring buffer
+typedef struct {
+  int* jobs;
+  int front;
+  int size;
+  int capacity;
+} JobRing;
+
+typedef struct {
+  int64_t key;
+  int left;
+  int right;
+  int parent;
+  bool red;
+} JobTreeNode;
+
+// red-black tree of jobs ordered by key, with ties broken by job index;
+// node n is the sentinel leaf
+typedef struct {
+  JobTreeNode* nodes;
+  int root;
+  int nil;
+  // job with the smallest key, nil if the tree is empty
+  int leftmost;
+  int size;
+} JobTree;
+
+static inline void JobHeapInit(JobHeap* heap) {
+  heap->size = 0;
+  heap->capacity = 16;
+  heap->entries = malloc(sizeof(JobHeapEntry) * heap->capacity);
+  if (!heap->entries) abort();
+}
+
+static inline void JobHeapFree(JobHeap* heap) {
+  free(heap->entries);
+}
+
+static inline bool JobHeapLess(const JobHeapEntry* a,
+                               const JobHeapEntry* b) {
+  return a->key < b->key || (a->key == b->key && a->job < b->job);
+}
+
+static inline void JobHeapPush(JobHeap* heap, int job, int64_t key) {
+  if (heap->size == heap->capacity) {
+    heap->entries = realloc(heap->entries, sizeof(JobHeapEntry) *
+                                           (heap->capacity *= 2));
+    if (!heap->entries) abort();
+  }
+  JobHeapEntry entry = { key, job };
+  int i = heap->size++;
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (!JobHeapLess(&entry, &heap->entries[parent]))
+      break;
+    heap->entries[i] = heap->entries[parent];
+    i = parent;
+  }
+  heap->entries[i] = entry;
+}
+
+static inline int JobHeapPop(JobHeap* heap) {
+  int job = heap->entries[0].job;
+  JobHeapEntry last = heap->entries[--heap->size];
+  int i = 0;
+  for (int child; (child = 2 * i + 1) < heap->size; i = child) {
+    if (child + 1 < heap->size &&
+        JobHeapLess(&heap->entries[child + 1], &heap->entries[child]))
+      ++child;
+    if (!JobHeapLess(&heap->entries[child], &last))
+      break;
+    heap->entries[i] = heap->entries[child];
+  }
+  heap->entries[i] = last;
+  return job;
+}
+
+static inline void JobRingInit(JobRing* ring) {
+  ring->front = ring->size = 0;
+  ring->capacity = 16;
+  ring->jobs = malloc(sizeof(int) * ring->capacity);
+  if (!ring->jobs) abort();
+}
+
+static inline void JobRingFree(JobRing* ring) {
+  free(ring->jobs);
+}
+
+static inline void JobRingPush(JobRing* ring, int job) {
+  if (ring->size == ring->capacity) {
+    int* jobs = malloc(sizeof(int) * ring->capacity * 2);
+    if (!jobs) abort();
+    for (int i = 0; i < ring->size; ++i)
+      jobs[i] = ring->jobs[(ring->front + i) % ring->capacity];
+    free(ring->jobs);
+    ring->jobs = jobs;
+    ring->front = 0;
+    ring->capacity *= 2;
+  }
+  ring->jobs[(ring->front + ring->size++) % ring->capacity] = job;
+}
+
+static inline int JobRingPop(JobRing* ring) {
+  int job = ring->jobs[ring->front];
+  ring->front = (ring->front + 1) % ring->capacity;
+  --ring->size;
+  return job;
+}
+
+static inline int JobRingPopBack(JobRing* ring) {
+  return ring->jobs[(ring->front + --ring->size) % ring->capacity];
+}
+
+static inline void JobTreeInit(JobTree* tree, int n) {
+  tree->nodes = calloc(n + 1, sizeof(JobTreeNode));
+  if (!tree->nodes) abort();
+  tree->root = tree->nil = tree->leftmost = n;
+  tree->size = 0;
+}
+
+static inline void JobTreeFree(JobTree* tree) {
+  free(tree->nodes);
+}
+
+static inline bool JobTreeLess(const JobTree* tree, int a, int b) {
+  const JobTreeNode* nodes = tree->nodes;
+  return nodes[a].key < nodes[b].key ||
+         (nodes[a].key == nodes[b].key && a < b);
+}
+
+// returns the job with the smallest key, or -1 if the tree is empty
+static inline int JobTreeFirst(const JobTree* tree) {
+  return tree->size > 0 ? tree->leftmost : -1;
+}
+
+static inline void JobTreeRotate(JobTree* tree, int x, bool left) {
+  JobTreeNode* nodes = tree->nodes;
+  int y = left ? nodes[x].right : nodes[x].left;
+  int inner = left ? nodes[y].left : nodes[y].right;
+  if (left)
+    nodes[x].right = inner;
+  else
+    nodes[x].left = inner;
+  if (inner != tree->nil)
+    nodes[inner].parent = x;
+  int parent = nodes[y].parent = nodes[x].parent;
+  if (parent == tree->nil)
+    tree->root = y;
+  else if (x == nodes[parent].left)
+    nodes[parent].left = y;
+  else
+    nodes[parent].right = y;
+  if (left)
+    nodes[y].left = x;
+  else
+    nodes[y].right = x;
+  nodes[x].parent = y;
+}
+
+static inline void JobTreeInsert(JobTree* tree, int job, int64_t key) {
+  JobTreeNode* nodes = tree->nodes;
+  nodes[job].key = key;
+  int parent = tree->nil;
+  for (int x = tree->root; x != tree->nil;) {
+    parent = x;
+    x = JobTreeLess(tree, job, x) ? nodes[x].left : nodes[x].right;
+  }
+  nodes[job].parent = parent;
+  nodes[job].left = nodes[job].right = tree->nil;
+  nodes[job].red = true;
+  if (parent == tree->nil)
+    tree->root = job;
+  else if (JobTreeLess(tree, job, parent))
+    nodes[parent].left = job;
+  else
+    nodes[parent].right = job;
+  if (tree->size++ == 0 || JobTreeLess(tree, job, tree->leftmost))
+    tree->leftmost = job;
+
+  for (int z = job; nodes[nodes[z].parent].red;) {
+    int p = nodes[z].parent;
+    int g = nodes[p].parent;
+    bool left = p == nodes[g].left;
+    int uncle = left ? nodes[g].right : nodes[g].left;
+    if (nodes[uncle].red) {
+      nodes[p].red = nodes[uncle].red = false;
+      nodes[g].red = true;
+      z = g;
+      continue;
+    }
+    if (z == (left ? nodes[p].right : nodes[p].left)) {
+      z = p;
+      JobTreeRotate(tree, z, left);
+      p = nodes[z].parent;
+    }
+    nodes[p].red = false;
+    nodes[g].red = true;
+    JobTreeRotate(tree, g, !left);
+  }
+  nodes[tree->root].red = false;
+}
+
+static inline void JobTreeTransplant(JobTree* tree, int u, int v) {
+  JobTreeNode* nodes = tree->nodes;
+  int parent = nodes[u].parent;
+  if (parent == tree->nil)
+    tree->root = v;
+  else if (u == nodes[parent].left)
+    nodes[parent].left = v;
+  else
+    nodes[parent].right = v;
+  nodes[v].parent = parent;
+}
+
+static inline int JobTreeMin(const JobTree* tree, int x) {
+  while (tree->nodes[x].left != tree->nil)
+    x = tree->nodes[x].left;
+  return x;
+}
+
+static inline void JobTreeRemove(JobTree* tree, int job) {
+  JobTreeNode* nodes = tree->nodes;
+  if (job == tree->leftmost) {
+    // the leftmost job has no left child
+    tree->leftmost = nodes[job].right != tree->nil ?
+                     JobTreeMin(tree, nodes[job].right) : nodes[job].parent;
+  }
+  --tree->size;
+
+  int x;
+  bool removedRed = nodes[job].red;
+  if (nodes[job].left == tree->nil) {
+    x = nodes[job].right;
+    JobTreeTransplant(tree, job, x);
+  } else if (nodes[job].right == tree->nil) {
+    x = nodes[job].left;
+    JobTreeTransplant(tree, job, x);
+  } else {
+    int y = JobTreeMin(tree, nodes[job].right);
+    removedRed = nodes[y].red;
+    x = nodes[y].right;
+    if (nodes[y].parent == job) {
+      nodes[x].parent = y;
+    } else {
+      JobTreeTransplant(tree, y, x);
+      nodes[y].right = nodes[job].right;
+      nodes[nodes[y].right].parent = y;
+    }
+    JobTreeTransplant(tree, job, y);
+    nodes[y].left = nodes[job].left;
+    nodes[nodes[y].left].parent = y;
+    nodes[y].red = nodes[job].red;
+  }
+  if (removedRed)
+    return;
+
+  while (x != tree->root && !nodes[x].red) {
+    int p = nodes[x].parent;
+    bool left = x == nodes[p].left;
+    int w = left ? nodes[p].right : nodes[p].left;
+    if (nodes[w].red) {
+      nodes[w].red = false;
+      nodes[p].red = true;
+      JobTreeRotate(tree, p, left);
+      w = left ? nodes[p].right : nodes[p].left;
+    }
+    int near = left ? nodes[w].left : nodes[w].right;
+    int far = left ? nodes[w].right : nodes[w].left;
+    if (!nodes[near].red && !nodes[far].red) {
+      nodes[w].red = true;
+      x = p;
+      continue;
+    }
+    if (!nodes[far].red) {
+      nodes[near].red = false;
+      nodes[w].red = true;
+      JobTreeRotate(tree, w, !left);
+      w = left ? nodes[p].right : nodes[p].left;
+      far = left ? nodes[w].right : nodes[w].left;
+    }
+    nodes[w].red = nodes[p].red;
+    nodes[p].red = false;
+    nodes[far].red = false;
+    JobTreeRotate(tree, p, left);
+    x = tree->root;
+  }
+  nodes[x].red = false;
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef RUNQUEUE_H
+#define RUNQUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "policy.h"
+
+// Run queues of the multi-cpu drivers, one per cpu or shared by all of
+// them. Processes are identified by their index into the driver's array of
+// processes and are taken in arrival order, or by remaining execution time
+// if shortestFirst, in which case it is given as the key when they are
+// queued.
+
+typedef struct {
+  bool shortestFirst;
+  JobRing ring;
+  JobHeap heap;
+} RunQueue;
+
+// how the multi-cpu drivers queue and preempt the processes of a policy
+typedef struct {
+  const char* name;
+  bool shortestFirst;
+  // a running process is queued again at the end of every time slice
+  bool roundRobin;
+  // a running process is queued again at every arrival
+  bool preemptive;
+} RunQueueDiscipline;
+
+static const RunQueueDiscipline runQueueDisciplines[] = {
+  { "FIFO", false, false, false },
+  { "RR", false, true, false },
+  { "SJF", true, false, false },
+  { "PSJF", true, false, true },
+};
+
+static inline void RunQueueInit(RunQueue* queue, bool shortestFirst) {
+  queue->shortestFirst = shortestFirst;
+  JobRingInit(&queue->ring);
+  JobHeapInit(&queue->heap);
+}
+
+static inline void RunQueueFree(RunQueue* queue) {
+  JobRingFree(&queue->ring);
+  JobHeapFree(&queue->heap);
+}
+
+static inline int RunQueueSize(const RunQueue* queue) {
+  return queue->shortestFirst ? queue->heap.size : queue->ring.size;
+}
+
+static inline void RunQueuePush(RunQueue* queue, int process,
+                                int64_t execTime) {
+  if (queue->shortestFirst)
+    JobHeapPush(&queue->heap, process, execTime);
+  else
+    JobRingPush(&queue->ring, process);
+}
+
+static inline int RunQueuePop(RunQueue* queue) {
+  return queue->shortestFirst ? JobHeapPop(&queue->heap) :
+                                JobRingPop(&queue->ring);
+}
+
+// takes the process that would run last, or the shortest one if
+// shortestFirst
+static inline int RunQueueSteal(RunQueue* queue) {
+  return queue->shortestFirst ? JobHeapPop(&queue->heap) :
+                                JobRingPopBack(&queue->ring);
+}
+
+// returns NULL if the policy cannot be run on more than one cpu
+static inline const RunQueueDiscipline* RunQueueDisciplineFind(
+    const char* policy) {
+  for (size_t i = 0;
+       i < sizeof(runQueueDisciplines) / sizeof(RunQueueDiscipline); ++i) {
+    if (strcmp(runQueueDisciplines[i].name, policy) == 0)
+      return &runQueueDisciplines[i];
+  }
+  return NULL;
+}
+
+#endif
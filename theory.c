@@ -1,54 +1,310 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "workload.h"
+#include "histogram.h"
+#include "policies.h"
+#include "runqueue.h"
 
 typedef struct {
   char name[32];
   int readyTime;
+  // remaining execution time
   int execTime;
+  // execution time given by the workload
+  int burstTime;
+  // absolute time by which the process should finish, WORKLOAD_NO_DEADLINE
+  // if none
+  int deadline;
+  int weight;
   int index;
   pid_t pid;
+  // cpu the process last ran or was queued on in the multi-cpu models, -1
+  // if none
+  int cpu;
   bool started;
   bool finished;
   int startTime;
   int finishTime;
 } Process;
 
+#define DEFAULT_QUANTUM 500
+#define DEFAULT_BALANCE_PERIOD 1000
+
+// how processes are spread over the cpus when there is more than one
+typedef enum {
+  // all cpus dispatch from a single queue
+  BALANCE_GLOBAL,
+  // every cpu has its own queue, and queued processes are moved from the
+  // busiest to the idlest cpu every balancePeriod
+  BALANCE_PERIODIC,
+  // every cpu has its own queue, and a cpu whose queue is empty takes a
+  // process from the longest queue
+  BALANCE_STEAL
+} Balance;
+
+typedef struct {
+  // length of a round robin time slice
+  int quantum;
+  // print per-process metrics and their distribution
+  bool metrics;
+  // CFS target latency and minimum granularity
+  int targetLatency;
+  int minGranularity;
+  // number of MLFQ levels and their quanta, 0 for the default
+  int levels;
+  int levelQuanta[MLFQ_MAX_LEVELS];
+  int boostPeriod;
+  // EDF admission control
+  bool admission;
+  // seed of the lottery, 0 for the default
+  uint64_t seed;
+  // number of simulated cpus
+  int cpus;
+  Balance balance;
+  int balancePeriod;
+} Options;
+
 typedef struct {
-  int* queue;
+  // queue the cpu dispatches from, shared by all cpus with BALANCE_GLOBAL
+  RunQueue* queue;
+  // process running on the cpu, -1 if idle
+  int running;
+  // process that was running before the current event, -1 if none
+  int previous;
+  // when the current round robin time slice ends
+  int sliceEnd;
+} Cpu;
+
+typedef struct {
+  long long busy;
+  // number of times a process started or resumed running on the cpu
+  int dispatches;
+  // number of processes that came to the cpu from another one
+  int migrations;
+} CpuStats;
+
+// output of one workload in batch mode
+typedef struct {
+  char* output;
+  size_t size;
+  bool ok;
+  bool finished;
+} BatchResult;
+
+typedef struct {
+  char** paths;
   int n;
-  int front;
-  int back;
-} Queue;
-
-Queue* QueueNew(int n);
-void QueueDelete(Queue* queue);
-void QueuePush(Queue* queue, int data);
-int QueuePop(Queue* queue);
+  const Options* options;
+  // index of the next workload to be simulated
+  int next;
+  BatchResult* results;
+  pthread_mutex_t mutex;
+  pthread_cond_t done;
+} Batch;
+
+// scheduling figures of a round robin run with one quantum in sweep mode
+typedef struct {
+  int quantum;
+  double meanTurnaround;
+  int maxTurnaround;
+  double meanWaiting;
+  int maxWaiting;
+  double meanResponse;
+  int maxResponse;
+} SweepResult;
+
+typedef struct {
+  const Process* processes;
+  int n;
+  // options given to theory, of which each run overrides the quantum
+  const Options* options;
+  const int* quanta;
+  int count;
+  // index of the next quantum to be simulated
+  int next;
+  SweepResult* results;
+} Sweep;
+
+void RunPolicy(const Policy* policy, Process* processes, int n,
+               const Options* options, FILE* out, FILE* stats);
+void PolicyMultiCPU(Process* processes, int n,
+                    const RunQueueDiscipline* discipline,
+                    const Options* options, CpuStats* stats);
+void Dispatch(Process* processes, Cpu* cpus, CpuStats* stats, int cpu,
+              int execIndex, int currentTime, const Options* options);
+void BalanceQueues(const Process* processes, RunQueue* queues,
+                   const Cpu* cpus, int m);
+Process* ReadWorkload(Reader* reader, char* policy, int* n);
 int ProcessCmp(const void* pa, const void* pb);
-void PolicyFIFO(Process* processes, int n);
-void PolicyRR(Process* processes, int n);
-void PolicySJF(Process* processes, int n);
-void PolicyPSJF(Process* process, int n);
+bool Simulate(int fd, const Options* options, FILE* out);
+void PrintMetrics(const Process* processes, int n, FILE* out);
+void PrintCpuStats(const Process* processes, int n, const CpuStats* stats,
+                   int m, FILE* out);
+void* BatchWorker(void* arg);
+bool RunBatch(const char* path, const Options* options, int threads);
+int PathCmp(const void* pa, const void* pb);
+bool BatchPaths(const char* path, char*** paths, int* n);
+bool ParseQuanta(const char* list, int** quanta, int* count);
+void* SweepWorker(void* arg);
+bool RunSweep(const char* list, const Options* options, int threads);
+
+int main(int argc, char** argv) {
+  Options options = { DEFAULT_QUANTUM, false, DEFAULT_TARGET_LATENCY,
+                      DEFAULT_MIN_GRANULARITY, 0, { 0 }, DEFAULT_BOOST_PERIOD,
+                      false, 0, 1, BALANCE_GLOBAL, DEFAULT_BALANCE_PERIOD };
+  const char* batchPath = NULL;
+  const char* sweepList = NULL;
+  int threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int opt;
+  while ((opt = getopt(argc, argv, "aB:b:C:G:i:j:L:l:M:mP:q:S:s:")) != -1) {
+    switch (opt) {
+      case 'a':
+        options.admission = true;
+        break;
+      case 'B':
+        options.boostPeriod = atoi(optarg);
+        break;
+      case 'b':
+        batchPath = optarg;
+        break;
+      case 'C':
+        options.cpus = atoi(optarg);
+        break;
+      case 'G':
+        options.minGranularity = atoi(optarg);
+        break;
+      case 'i':
+        options.balancePeriod = atoi(optarg);
+        break;
+      case 'j':
+        threads = atoi(optarg);
+        break;
+      case 'L':
+        options.targetLatency = atoi(optarg);
+        break;
+      case 'l':
+        if (strcmp(optarg, "global") == 0) {
+          options.balance = BALANCE_GLOBAL;
+        } else if (strcmp(optarg, "periodic") == 0) {
+          options.balance = BALANCE_PERIODIC;
+        } else if (strcmp(optarg, "steal") == 0) {
+          options.balance = BALANCE_STEAL;
+        } else {
+          fprintf(stderr, "%s: unknown balancing model\n", optarg);
+          return 1;
+        }
+        break;
+      case 'M':
+        if (!MLFQParseQuanta(optarg, options.levelQuanta, &options.levels)) {
+          fprintf(stderr, "%s: invalid list of quanta\n", optarg);
+          return 1;
+        }
+        break;
+      case 'm':
+        options.metrics = true;
+        break;
+      case 'P':
+        if (!PolicyLoad(optarg))
+          return 1;
+        break;
+      case 'q':
+        options.quantum = atoi(optarg);
+        break;
+      case 'S':
+        options.seed = strtoull(optarg, NULL, 0);
+        break;
+      case 's':
+        sweepList = optarg;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-m] [-q quantum] "
+                        "[-b directory|manifest] [-s quanta] [-j threads] "
+                        "[-C cpus] [-l global|periodic|steal] "
+                        "[-i balance period] [-P policy plugin] "
+                        "[-L target latency] [-G minimum granularity] "
+                        "[-M level quanta] [-B boost period] [-a] "
+                        "[-S lottery seed]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (threads < 1) threads = 1;
+  if (options.quantum < 1 || options.targetLatency < 1 ||
+      options.minGranularity < 1 || options.boostPeriod < 1) {
+    fprintf(stderr, "quantum, target latency, granularity and boost period "
+                    "must be positive\n");
+    return 1;
+  }
+  if (options.cpus < 1 || options.balancePeriod < 1) {
+    fprintf(stderr, "number of cpus and balance period must be positive\n");
+    return 1;
+  }
+
+  if (batchPath)
+    return RunBatch(batchPath, &options, threads) ? 0 : 1;
+  if (sweepList)
+    return RunSweep(sweepList, &options, threads) ? 0 : 1;
 
-int main() {
   setvbuf(stdout, NULL, _IONBF, 0);
+  if (!Simulate(STDIN_FILENO, &options, stdout)) abort();
+}
 
-  char policy[8];
-  if (scanf("%8s", policy) != 1) abort();
-  
-  int n;
-  if (scanf("%d", &n) != 1) abort();
-  Process* processes = calloc(n, sizeof(Process));
-  for (int i = 0; i < n; ++i) {
-    if (scanf("%s%d%d", processes[i].name, &processes[i].readyTime,
-                        &processes[i].execTime) != 3) abort();
-    processes[i].index = i;
+// reads the workload into a new array of processes sorted by ready time,
+// then by input order, and copies its policy into policy; returns NULL if
+// it is invalid
+Process* ReadWorkload(Reader* reader, char* policy, int* n) {
+  Workload workload;
+  if (!WorkloadOpen(reader, &workload)) {
+    fprintf(stderr, "%s\n", workload.error);
+    return NULL;
   }
+  strcpy(policy, workload.policy);
+  *n = workload.count;
+  Process* processes = calloc(*n, sizeof(Process));
+  if (!processes) abort();
+  for (int i = 0; i < *n; ++i) {
+    WorkloadJob job;
+    if (!WorkloadNext(&workload, &job)) {
+      fprintf(stderr, "%s %d\n", workload.error, i + 1);
+      free(processes);
+      return NULL;
+    }
+    memcpy(processes[i].name, job.name, sizeof(processes[i].name));
+    processes[i].readyTime = job.readyTime;
+    processes[i].execTime = processes[i].burstTime = job.execTime;
+    processes[i].deadline = job.deadline;
+    processes[i].weight = job.weight;
+    processes[i].index = job.index;
+  }
+  if (!workload.binary)
+    qsort(processes, *n, sizeof(Process), ProcessCmp);
+  return processes;
+}
 
-  qsort(processes, n, sizeof(Process), ProcessCmp);
+int ProcessCmp(const void* pa, const void* pb) {
+  const Process* a = pa;
+  const Process* b = pb;
+  return WorkloadOrder(a->readyTime, a->index, b->readyTime, b->index);
+}
+
+bool Simulate(int fd, const Options* options, FILE* out) {
+  Reader reader;
+  if (!ReaderOpen(&reader, fd)) return false;
+  char policy[WORKLOAD_POLICY_SIZE];
+  int n;
+  Process* processes = ReadWorkload(&reader, policy, &n);
+  ReaderClose(&reader);
+  if (!processes) return false;
   
 #ifdef DEBUG
   printf("input:\n%s\n%d\n", policy, n);
@@ -59,196 +315,652 @@ int main() {
   printf("\n");
 #endif
 
-  if (strcmp(policy, "FIFO") == 0)
-    PolicyFIFO(processes, n);
-  else if (strcmp(policy, "RR") == 0)
-    PolicyRR(processes, n);
-  else if (strcmp(policy, "SJF") == 0)
-    PolicySJF(processes, n);
-  else if (strcmp(policy, "PSJF") == 0)
-    PolicyPSJF(processes, n);
+  CpuStats* cpuStats = NULL;
+  char* policyStats = NULL;
+  size_t policyStatsSize = 0;
+  if (options->cpus > 1) {
+    const RunQueueDiscipline* discipline = RunQueueDisciplineFind(policy);
+    if (!discipline) {
+      fprintf(stderr, "%s: not supported with more than one cpu\n", policy);
+      free(processes);
+      return false;
+    }
+    cpuStats = calloc(options->cpus, sizeof(CpuStats));
+    if (!cpuStats) abort();
+    PolicyMultiCPU(processes, n, discipline, options, cpuStats);
+  } else if (PolicyFind(policy)) {
+    FILE* stats = open_memstream(&policyStats, &policyStatsSize);
+    if (!stats) abort();
+    RunPolicy(PolicyFind(policy), processes, n, options, out, stats);
+    fclose(stats);
+  } else {
+    fprintf(stderr, "%s: unknown policy\n", policy);
+    free(processes);
+    return false;
+  }
   
-  printf("absolute:\n");
+  fprintf(out, "absolute:\n");
   for (int i = 0; i < n; ++i)
-    printf("%s: (%d, %d)\n", processes[i].name, processes[i].startTime,
-                             processes[i].finishTime);
+    fprintf(out, "%s: (%d, %d)\n", processes[i].name, processes[i].startTime,
+                                  processes[i].finishTime);
   int minTime = INT_MAX;
   for (int i = 0; i < n; ++i) {
     if (processes[i].startTime < minTime)
       minTime = processes[i].startTime;
   }
-  printf("relative:\n");
+  fprintf(out, "relative:\n");
   for (int i = 0; i < n; ++i)
-    printf("%s: (%d, %d)\n", processes[i].name,
-                             processes[i].startTime - minTime,
-                             processes[i].finishTime - minTime);
+    fprintf(out, "%s: (%d, %d)\n", processes[i].name,
+                                  processes[i].startTime - minTime,
+                                  processes[i].finishTime - minTime);
+  if (cpuStats)
+    PrintCpuStats(processes, n, cpuStats, options->cpus, out);
+  fwrite(policyStats, 1, policyStatsSize, out);
+  if (options->metrics)
+    PrintMetrics(processes, n, out);
 
+  free(cpuStats);
+  free(policyStats);
   free(processes);
+  return true;
 }
 
-Queue* QueueNew(int n) {
-  Queue* queue = malloc(sizeof(Queue));
-  queue->queue = malloc(sizeof(int) * n);
-  queue->n = n;
-  queue->front = queue->back = 0;
-  return queue;
+// slowdown is recorded in thousandths
+#define SLOWDOWN_SCALE 1000
+
+enum { TURNAROUND, WAITING, RESPONSE, SLOWDOWN, METRICS };
+
+void PrintMetrics(const Process* processes, int n, FILE* out) {
+  Histogram* histograms = malloc(sizeof(Histogram) * METRICS);
+  for (int i = 0; i < METRICS; ++i)
+    HistogramInit(&histograms[i]);
+
+  fprintf(out, "metrics:\n");
+  for (int i = 0; i < n; ++i) {
+    int turnaround = processes[i].finishTime - processes[i].readyTime;
+    int waiting = turnaround - processes[i].burstTime;
+    int response = processes[i].startTime - processes[i].readyTime;
+    double slowdown = (double)turnaround / (processes[i].burstTime > 0 ?
+                                            processes[i].burstTime : 1);
+    fprintf(out, "%s: turnaround %d, waiting %d, response %d, "
+                 "slowdown %.3f\n", processes[i].name, turnaround, waiting,
+                                    response, slowdown);
+    HistogramRecord(&histograms[TURNAROUND], turnaround);
+    HistogramRecord(&histograms[WAITING], waiting);
+    HistogramRecord(&histograms[RESPONSE], response);
+    HistogramRecord(&histograms[SLOWDOWN], slowdown * SLOWDOWN_SCALE + 0.5);
+  }
+
+  static const char* names[METRICS] = { "turnaround", "waiting", "response",
+                                        "slowdown" };
+  static const double percentiles[] = { 50, 90, 99, 99.9 };
+  fprintf(out, "summary:\n");
+  for (int i = 0; i < METRICS; ++i) {
+    double scale = i == SLOWDOWN ? SLOWDOWN_SCALE : 1;
+    int precision = i == SLOWDOWN ? 3 : 0;
+    fprintf(out, "%s: mean %.3f", names[i],
+            HistogramMean(&histograms[i]) / scale);
+    for (int j = 0; j < sizeof(percentiles) / sizeof(double); ++j) {
+      fprintf(out, ", p%g %.*f", percentiles[j], precision,
+              HistogramPercentile(&histograms[i], percentiles[j]) / scale);
+    }
+    fprintf(out, ", max %.*f\n", precision, histograms[i].max / scale);
+  }
+
+  free(histograms);
 }
 
-void QueueDelete(Queue* queue) {
-  free(queue->queue);
-  free(queue);
+void PrintCpuStats(const Process* processes, int n, const CpuStats* stats,
+                   int m, FILE* out) {
+  int endTime = processes[0].readyTime;
+  for (int i = 0; i < n; ++i) {
+    if (processes[i].finishTime > endTime)
+      endTime = processes[i].finishTime;
+  }
+  long long span = endTime - processes[0].readyTime;
+  long long migrations = 0;
+  fprintf(out, "cpus:\n");
+  for (int c = 0; c < m; ++c) {
+    fprintf(out, "cpu %d: utilization %.1f%%, busy %lld, dispatches %d, "
+                 "migrations %d\n", c,
+            span > 0 ? 100.0 * stats[c].busy / span : 0, stats[c].busy,
+            stats[c].dispatches, stats[c].migrations);
+    migrations += stats[c].migrations;
+  }
+  fprintf(out, "migrations: %lld\n", migrations);
 }
 
-void QueuePush(Queue* queue, int data) {
-  queue->queue[queue->back] = data;
-  queue->back = (queue->back + 1) % queue->n;
+void* BatchWorker(void* arg) {
+  Batch* batch = arg;
+  for (int i; (i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) <
+              batch->n;) {
+    BatchResult result = { NULL, 0, false, true };
+    FILE* out = open_memstream(&result.output, &result.size);
+    int fd = open(batch->paths[i], O_RDONLY);
+    if (out && fd >= 0)
+      result.ok = Simulate(fd, batch->options, out);
+    if (fd >= 0) close(fd);
+    if (out) fclose(out);
+
+    pthread_mutex_lock(&batch->mutex);
+    batch->results[i] = result;
+    pthread_cond_broadcast(&batch->done);
+    pthread_mutex_unlock(&batch->mutex);
+  }
+  return NULL;
 }
 
-int QueuePop(Queue* queue) {
-  int data = queue->queue[queue->front];
-  queue->front = (queue->front + 1) % queue->n;
-  return data;
+bool RunBatch(const char* path, const Options* options, int threads) {
+  Batch batch;
+  memset(&batch, 0, sizeof(Batch));
+  batch.options = options;
+  if (!BatchPaths(path, &batch.paths, &batch.n)) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return false;
+  }
+  batch.results = calloc(batch.n, sizeof(BatchResult));
+  pthread_mutex_init(&batch.mutex, NULL);
+  pthread_cond_init(&batch.done, NULL);
+  if (threads > batch.n) threads = batch.n;
+  pthread_t* workers = malloc(sizeof(pthread_t) * threads);
+  for (int i = 0; i < threads; ++i)
+    pthread_create(&workers[i], NULL, BatchWorker, &batch);
+
+  // results are written in input order as soon as they are available
+  bool ok = true;
+  for (int i = 0; i < batch.n; ++i) {
+    pthread_mutex_lock(&batch.mutex);
+    while (!batch.results[i].finished)
+      pthread_cond_wait(&batch.done, &batch.mutex);
+    BatchResult result = batch.results[i];
+    pthread_mutex_unlock(&batch.mutex);
+
+    printf("%s==> %s <==\n", i > 0 ? "\n" : "", batch.paths[i]);
+    if (result.ok) {
+      fwrite(result.output, 1, result.size, stdout);
+    } else {
+      printf("error: could not simulate workload\n");
+      ok = false;
+    }
+    free(result.output);
+    free(batch.paths[i]);
+  }
+
+  for (int i = 0; i < threads; ++i)
+    pthread_join(workers[i], NULL);
+  pthread_cond_destroy(&batch.done);
+  pthread_mutex_destroy(&batch.mutex);
+  free(workers);
+  free(batch.results);
+  free(batch.paths);
+  return ok;
 }
 
-int ProcessCmp(const void* pa, const void* pb) {
-  const Process* a = pa;
-  const Process* b = pb;
-  if (a->readyTime == b->readyTime)
-    return a->index - b->index;
-  return a->readyTime - b->readyTime;
+int PathCmp(const void* pa, const void* pb) {
+  return strcmp(*(char* const*)pa, *(char* const*)pb);
 }
 
-void PolicyFIFO(Process* processes, int n) {
-  int currentTime = processes[0].startTime;
-  for (int i = 0; i < n; ++i) {
-    processes[i].startTime = currentTime;
-    processes[i].finishTime = (currentTime += processes[i].execTime);
+bool BatchPaths(const char* path, char*** paths, int* n) {
+  int capacity = 16;
+  *paths = malloc(sizeof(char*) * capacity);
+  *n = 0;
+  DIR* dir = opendir(path);
+  if (dir) {
+    // every regular file in the directory, in name order
+    for (struct dirent* entry; (entry = readdir(dir));) {
+      char* file = malloc(strlen(path) + strlen(entry->d_name) + 2);
+      sprintf(file, "%s/%s", path, entry->d_name);
+      struct stat st;
+      if (stat(file, &st) < 0 || !S_ISREG(st.st_mode)) {
+        free(file);
+        continue;
+      }
+      if (*n == capacity)
+        *paths = realloc(*paths, sizeof(char*) * (capacity *= 2));
+      (*paths)[(*n)++] = file;
+    }
+    closedir(dir);
+    qsort(*paths, *n, sizeof(char*), PathCmp);
+    return true;
+  }
+  if (errno != ENOTDIR) return false;
+
+  // a manifest with one workload file per line
+  FILE* manifest = fopen(path, "r");
+  if (!manifest) return false;
+  char* line = NULL;
+  size_t lineSize = 0;
+  for (ssize_t length; (length = getline(&line, &lineSize, manifest)) != -1;) {
+    while (length > 0 && IsSpace(line[length - 1]))
+      line[--length] = '\0';
+    if (length == 0) continue;
+    if (*n == capacity)
+      *paths = realloc(*paths, sizeof(char*) * (capacity *= 2));
+    (*paths)[(*n)++] = strdup(line);
+  }
+  free(line);
+  fclose(manifest);
+  return true;
+}
+
+bool ParseQuanta(const char* list, int** quanta, int* count) {
+  int capacity = 16;
+  *quanta = malloc(sizeof(int) * capacity);
+  *count = 0;
+  // comma-separated quanta or ranges of quanta in the form first-last[:step]
+  for (const char* p = list; *p;) {
+    char* end;
+    long first = strtol(p, &end, 10);
+    long last = first;
+    long step = 1;
+    if (end == p) return false;
+    if (*end == '-') {
+      p = end + 1;
+      last = strtol(p, &end, 10);
+      if (end == p) return false;
+      if (*end == ':') {
+        p = end + 1;
+        step = strtol(p, &end, 10);
+        if (end == p) return false;
+      }
+    }
+    if (first < 1 || last < first || last > INT_MAX || step < 1) return false;
+    for (long quantum = first; quantum <= last; quantum += step) {
+      if (*count == capacity)
+        *quanta = realloc(*quanta, sizeof(int) * (capacity *= 2));
+      (*quanta)[(*count)++] = quantum;
+    }
+    if (*end == ',')
+      ++end;
+    else if (*end != '\0')
+      return false;
+    p = end;
   }
+  return *count > 0;
 }
 
-void PolicyRR(Process* processes, int n) {
-  Queue* queue = QueueNew(n);
+void* SweepWorker(void* arg) {
+  Sweep* sweep = arg;
+  Process* processes = malloc(sizeof(Process) * sweep->n);
+  CpuStats* cpuStats = calloc(sweep->options->cpus, sizeof(CpuStats));
+  if (!processes || !cpuStats) abort();
+  for (int i; (i = __atomic_fetch_add(&sweep->next, 1, __ATOMIC_RELAXED)) <
+              sweep->count;) {
+    memcpy(processes, sweep->processes, sizeof(Process) * sweep->n);
+    Options options = *sweep->options;
+    options.quantum = sweep->quanta[i];
+    if (options.cpus > 1) {
+      memset(cpuStats, 0, sizeof(CpuStats) * options.cpus);
+      PolicyMultiCPU(processes, sweep->n, RunQueueDisciplineFind("RR"),
+                     &options, cpuStats);
+    } else {
+      RunPolicy(&policyRR, processes, sweep->n, &options, NULL, NULL);
+    }
+
+    SweepResult* result = &sweep->results[i];
+    result->quantum = options.quantum;
+    long long turnaround = 0, waiting = 0, response = 0;
+    for (int j = 0; j < sweep->n; ++j) {
+      int jobTurnaround = processes[j].finishTime - processes[j].readyTime;
+      int jobWaiting = jobTurnaround - sweep->processes[j].execTime;
+      int jobResponse = processes[j].startTime - processes[j].readyTime;
+      turnaround += jobTurnaround;
+      waiting += jobWaiting;
+      response += jobResponse;
+      if (jobTurnaround > result->maxTurnaround)
+        result->maxTurnaround = jobTurnaround;
+      if (jobWaiting > result->maxWaiting)
+        result->maxWaiting = jobWaiting;
+      if (jobResponse > result->maxResponse)
+        result->maxResponse = jobResponse;
+    }
+    result->meanTurnaround = (double)turnaround / sweep->n;
+    result->meanWaiting = (double)waiting / sweep->n;
+    result->meanResponse = (double)response / sweep->n;
+  }
+  free(processes);
+  free(cpuStats);
+  return NULL;
+}
 
-  int lastAddedIndex = -1;
+bool RunSweep(const char* list, const Options* options, int threads) {
+  Sweep sweep;
+  memset(&sweep, 0, sizeof(Sweep));
+  sweep.options = options;
+  int* quanta;
+  if (!ParseQuanta(list, &quanta, &sweep.count)) {
+    fprintf(stderr, "%s: invalid list of quanta\n", list);
+    free(quanta);
+    return false;
+  }
+  sweep.quanta = quanta;
+
+  Reader reader;
+  if (!ReaderOpen(&reader, STDIN_FILENO)) abort();
+  char policy[WORKLOAD_POLICY_SIZE];
+  Process* processes = ReadWorkload(&reader, policy, &sweep.n);
+  ReaderClose(&reader);
+  if (!processes) abort();
+  // only round robin has a quantum to sweep
+  if (strcmp(policy, "RR") != 0) {
+    fprintf(stderr, "%s: quanta can only be swept with RR\n", policy);
+    free(processes);
+    free(quanta);
+    return false;
+  }
+  sweep.processes = processes;
+  sweep.results = calloc(sweep.count, sizeof(SweepResult));
+
+  if (threads > sweep.count) threads = sweep.count;
+  pthread_t* workers = malloc(sizeof(pthread_t) * threads);
+  for (int i = 0; i < threads; ++i)
+    pthread_create(&workers[i], NULL, SweepWorker, &sweep);
+  for (int i = 0; i < threads; ++i)
+    pthread_join(workers[i], NULL);
+
+  printf("quantum turnaround(mean max) waiting(mean max) "
+         "response(mean max)\n");
+  for (int i = 0; i < sweep.count; ++i) {
+    const SweepResult* result = &sweep.results[i];
+    printf("%d %.2f %d %.2f %d %.2f %d\n", result->quantum,
+           result->meanTurnaround, result->maxTurnaround,
+           result->meanWaiting, result->maxWaiting,
+           result->meanResponse, result->maxResponse);
+  }
+
+  free(workers);
+  free(sweep.results);
+  free(processes);
+  free(quanta);
+  return true;
+}
+
+// Simulates the policy on one cpu. Instead of stepping one unit of time at a
+// time, it jumps directly to the next event: the completion of the running
+// process, the end of its time slice or the next arrival. The name of each
+// process is printed when it first runs if out is not NULL, and statistics
+// kept by the policy are printed to stats if it is not NULL.
+void RunPolicy(const Policy* policy, Process* processes, int n,
+               const Options* options, FILE* out, FILE* stats) {
+  PolicyJob* jobs = calloc(n, sizeof(PolicyJob));
+  if (!jobs) abort();
+  POLICY_JOBS_INIT(jobs, processes, n);
+  PolicyParams params = { options->quantum, options->targetLatency,
+                          options->minGranularity, options->levels,
+                          options->levelQuanta, options->boostPeriod,
+                          options->admission, options->seed };
+  void* state = policy->create(jobs, n, &params);
+
+  int currentTime = processes[0].readyTime;
   int execIndex = -1;
-  int execTime = 0;
-  int finishedProcesses = 0;
-  for (int currentTime = processes[0].readyTime; finishedProcesses < n;
-       ++currentTime) {
-    for (int i = lastAddedIndex + 1; i < n &&
-         processes[i].readyTime <= currentTime; ++i) {
-      QueuePush(queue, lastAddedIndex = i);
+  int sliceEnd = INT_MAX;
+  for (int i = 0, finishedProcesses = 0; finishedProcesses < n;) {
+    bool preempted = false;
+    for (; i < n && processes[i].readyTime <= currentTime; ++i)
+      preempted |= policy->onArrival(state, i, currentTime);
+    if (policy->onEvent)
+      policy->onEvent(state, currentTime);
+    if (execIndex != -1 && (preempted || currentTime == sliceEnd)) {
 #ifdef DEBUG
-      // printf("%d: added P%d to queue\n", currentTime, i + 1);
+      printf("%d: P%d preempted (%d)\n", currentTime, execIndex + 1,
+             jobs[execIndex].execTime);
 #endif
+      policy->onPreempt(state, execIndex, currentTime);
+      execIndex = -1;
     }
+
     if (execIndex == -1) {
-      execIndex = QueuePop(queue);
-#ifdef DEBUG
-      //printf("%d: initial chosen process P%d (%d)\n", currentTime,
-             //execIndex + 1, processes[execIndex].execTime);
-#endif
-    } else if (processes[execIndex].execTime == 0) {
+      int slice;
+      if ((execIndex = policy->pickNext(state, currentTime, &slice)) == -1) {
+        // the cpu is idle until the next arrival
+        if (i == n) abort();
+        currentTime = processes[i].readyTime;
+        continue;
+      }
+      sliceEnd = slice < INT_MAX - currentTime ? currentTime + slice : INT_MAX;
+      if (!processes[execIndex].started) {
+        processes[execIndex].started = true;
+        processes[execIndex].startTime = currentTime;
+        if (out)
+          fprintf(out, "%s\n", processes[execIndex].name);
+      }
 #ifdef DEBUG
-      int finishedIndex = execIndex;
+      printf("%d: P%d chosen (%d)\n", currentTime, execIndex + 1,
+             jobs[execIndex].execTime);
 #endif
+    }
+
+    int nextTime = currentTime + jobs[execIndex].execTime;
+    if (sliceEnd < nextTime)
+      nextTime = sliceEnd;
+    if (i < n && processes[i].readyTime < nextTime)
+      nextTime = processes[i].readyTime;
+    jobs[execIndex].execTime -= nextTime - currentTime;
+    currentTime = nextTime;
+    if (jobs[execIndex].execTime == 0) {
       processes[execIndex].finishTime = currentTime;
+      processes[execIndex].finished = true;
       ++finishedProcesses;
-      execIndex = QueuePop(queue);
-#ifdef DEBUG
-      printf("%d: P%d finished, P%d chosen (%d)\n", currentTime,
-             finishedIndex + 1, execIndex + 1, processes[execIndex].execTime);
-#endif
-      execTime = 0;
-    } else if (execTime == 500) {
-#ifdef DEBUG
-      int preemptedIndex = execIndex;
-#endif
-      QueuePush(queue, execIndex);
-      execIndex = QueuePop(queue);
+      if (policy->onFinish)
+        policy->onFinish(state, execIndex, currentTime);
 #ifdef DEBUG
-      printf("%d: P%d prempted (%d), P%d chosen (%d)\n", currentTime,
-             preemptedIndex + 1, processes[preemptedIndex].execTime,
-             execIndex + 1, processes[execIndex].execTime);
+      printf("%d: P%d finished\n", currentTime, execIndex + 1);
 #endif
-      execTime = 0;
+      execIndex = -1;
     }
-    if (!processes[execIndex].started) {
-#ifdef DEBUG
-      //printf("P%d started (%d)\n", execIndex + 1,
-             //processes[execIndex].execTime);
-#endif
-      processes[execIndex].started = true;
-      printf("%s\n", processes[execIndex].name);
-      processes[execIndex].startTime = currentTime;
-    }
-    ++execTime;
-    --processes[execIndex].execTime;
   }
 
-  QueueDelete(queue);
+  if (stats && policy->report)
+    policy->report(state, stats);
+  policy->destroy(state);
+  free(jobs);
 }
 
-void PolicySJF(Process* processes, int n) {
+// Simulates options->cpus cpus running the policy, using the balancing
+// model in options->balance. Like the single-cpu policies it jumps from
+// event to event: an arrival, a completion, the end of a round robin time
+// slice, or a balancing tick while processes are queued. At each event
+// arrivals are queued first, then preempted processes, and then idle cpus
+// dispatch from their queue and, with BALANCE_STEAL, from other queues.
+void PolicyMultiCPU(Process* processes, int n,
+                    const RunQueueDiscipline* discipline,
+                    const Options* options, CpuStats* stats) {
+  bool shortestFirst = discipline->shortestFirst;
+  bool roundRobin = discipline->roundRobin;
+  bool preemptive = discipline->preemptive;
+
+  int m = options->cpus;
+  int queueCount = options->balance == BALANCE_GLOBAL ? 1 : m;
+  RunQueue* queues = malloc(sizeof(RunQueue) * queueCount);
+  Cpu* cpus = malloc(sizeof(Cpu) * m);
+  // cpus that are idle and processes taken from a queue for them
+  int* idle = malloc(sizeof(int) * m);
+  int* picked = malloc(sizeof(int) * m);
+  if (!queues || !cpus || !idle || !picked) abort();
+  for (int q = 0; q < queueCount; ++q)
+    RunQueueInit(&queues[q], shortestFirst);
+  for (int c = 0; c < m; ++c) {
+    cpus[c].queue = &queues[queueCount == 1 ? 0 : c];
+    cpus[c].running = cpus[c].previous = -1;
+  }
+  for (int i = 0; i < n; ++i)
+    processes[i].cpu = -1;
+
   int currentTime = processes[0].readyTime;
-  for (int i = 0; i < n; ++i) {
-    int execTime = INT_MAX;
-    int execIndex;
-    for (int j = 0; j < n && processes[j].readyTime <= currentTime; ++j) {
-      if (!processes[j].started && processes[j].execTime < execTime) {
-        execTime = processes[j].execTime;
-        execIndex = j;
+  int nextBalance = currentTime + options->balancePeriod;
+  int queued = 0;
+  for (int i = 0, finishedProcesses = 0; finishedProcesses < n;) {
+    for (; i < n && processes[i].readyTime <= currentTime; ++i, ++queued) {
+      int target = 0;
+      if (queueCount > 1) {
+        int targetLoad = INT_MAX;
+        for (int c = 0; c < m; ++c) {
+          int load = RunQueueSize(&queues[c]) + (cpus[c].running != -1);
+          if (load < targetLoad) {
+            target = c;
+            targetLoad = load;
+          }
+        }
+        processes[i].cpu = target;
       }
+      RunQueuePush(&queues[target], i, processes[i].execTime);
     }
-#ifdef DEBUG
-    printf("current time: %d, chosen %s\n", currentTime,
-           processes[execIndex].name);
-#endif
-    processes[execIndex].started = true;
-    processes[execIndex].startTime = currentTime;
-    processes[execIndex].finishTime = (currentTime += execTime);
-  }
-}
 
-void PolicyPSJF(Process* processes, int n) {
-  int currentTime = processes[0].readyTime;
-  int j;
-  for (int remainingProcesses = n; remainingProcesses > 0;) {
-    int execTime = INT_MAX;
-    int execIndex;
-    for (j = 0; j < n && processes[j].readyTime <= currentTime; ++j) {
-      if (!processes[j].finished && processes[j].execTime < execTime) {
-        execTime = processes[j].execTime;
-        execIndex = j;
+    // processes whose time slice ended enter the queue after the arrivals;
+    // with PSJF every running process competes with the arrivals again
+    for (int c = 0; c < m; ++c) {
+      if (cpus[c].running != -1 &&
+          (preemptive || (roundRobin && cpus[c].sliceEnd == currentTime))) {
+        RunQueuePush(cpus[c].queue, cpus[c].running,
+                     processes[cpus[c].running].execTime);
+        ++queued;
+        cpus[c].previous = cpus[c].running;
+        cpus[c].running = -1;
       }
     }
-#ifdef DEBUG
-    printf("current time %d, chosen %s\n", currentTime,
-           processes[execIndex].name);
-#endif
-    if (!processes[execIndex].started) {
-      processes[execIndex].started = true;
-      processes[execIndex].startTime = currentTime;
-#ifdef DEBUG
-    printf("%s started\n", processes[execIndex].name);
-#endif
+
+    if (options->balance == BALANCE_PERIODIC && currentTime >= nextBalance) {
+      BalanceQueues(processes, queues, cpus, m);
+      nextBalance += ((currentTime - nextBalance) / options->balancePeriod +
+                      1) * options->balancePeriod;
     }
-    int waitingTime = processes[j].readyTime - currentTime;
-    if (j == n || execTime <= waitingTime) {
-      processes[execIndex].finishTime = (currentTime += execTime);
-      processes[execIndex].finished = true;
-      --remainingProcesses;
+
+    for (int q = 0; q < queueCount; ++q) {
+      int idleCount = 0;
+      if (queueCount == 1) {
+        for (int c = 0; c < m; ++c) {
+          if (cpus[c].running == -1)
+            idle[idleCount++] = c;
+        }
+      } else if (cpus[q].running == -1) {
+        idle[idleCount++] = q;
+      }
+      int count = RunQueueSize(&queues[q]) < idleCount ?
+                  RunQueueSize(&queues[q]) : idleCount;
+      for (int k = 0; k < count; ++k)
+        picked[k] = RunQueuePop(&queues[q]);
+      queued -= count;
+      // keep processes on the cpu they last ran on where possible
+      for (int k = 0; k < count; ++k) {
+        int cpu = processes[picked[k]].cpu;
+        if (cpu != -1 && cpus[cpu].running == -1 &&
+            cpus[cpu].queue == &queues[q]) {
+          Dispatch(processes, cpus, stats, cpu, picked[k], currentTime,
+                   options);
+          picked[k] = -1;
+        }
+      }
+      for (int k = 0, j = 0; k < count; ++k) {
+        if (picked[k] == -1)
+          continue;
+        while (cpus[idle[j]].running != -1)
+          ++j;
+        Dispatch(processes, cpus, stats, idle[j], picked[k], currentTime,
+                 options);
+      }
+    }
+
+    if (options->balance == BALANCE_STEAL && queued > 0) {
+      for (int c = 0; c < m; ++c) {
+        if (cpus[c].running != -1)
+          continue;
+        RunQueue* victim = NULL;
+        for (int q = 0; q < queueCount; ++q) {
+          if (RunQueueSize(&queues[q]) > 0 &&
+              (!victim || RunQueueSize(&queues[q]) > RunQueueSize(victim)))
+            victim = &queues[q];
+        }
+        if (!victim)
+          break;
+        Dispatch(processes, cpus, stats, c, RunQueueSteal(victim),
+                 currentTime, options);
+        --queued;
+      }
+    }
+    for (int c = 0; c < m; ++c)
+      cpus[c].previous = -1;
+
+    int nextTime = i < n ? processes[i].readyTime : INT_MAX;
+    for (int c = 0; c < m; ++c) {
+      if (cpus[c].running == -1)
+        continue;
+      int eventTime = currentTime + processes[cpus[c].running].execTime;
+      if (roundRobin && cpus[c].sliceEnd < eventTime)
+        eventTime = cpus[c].sliceEnd;
+      if (eventTime < nextTime)
+        nextTime = eventTime;
+    }
+    if (options->balance == BALANCE_PERIODIC && queued > 0 &&
+        nextBalance < nextTime)
+      nextTime = nextBalance;
+
+    for (int c = 0; c < m; ++c) {
+      int execIndex = cpus[c].running;
+      if (execIndex == -1)
+        continue;
+      processes[execIndex].execTime -= nextTime - currentTime;
+      stats[c].busy += nextTime - currentTime;
+      if (processes[execIndex].execTime == 0) {
+        processes[execIndex].finishTime = nextTime;
+        processes[execIndex].finished = true;
+        ++finishedProcesses;
+        cpus[c].running = -1;
 #ifdef DEBUG
-    printf("%s finished\n", processes[execIndex].name);
+        printf("%d: P%d finished on cpu %d\n", nextTime, execIndex + 1, c);
 #endif
-    } else {
-      processes[execIndex].execTime -= waitingTime;
-      currentTime = processes[j].readyTime;
+      }
+    }
+    currentTime = nextTime;
+  }
+
+  for (int q = 0; q < queueCount; ++q)
+    RunQueueFree(&queues[q]);
+  free(queues);
+  free(cpus);
+  free(idle);
+  free(picked);
+}
+
+void Dispatch(Process* processes, Cpu* cpus, CpuStats* stats, int cpu,
+              int execIndex, int currentTime, const Options* options) {
+  Process* process = &processes[execIndex];
+  cpus[cpu].running = execIndex;
+  cpus[cpu].sliceEnd = currentTime + options->quantum;
+  if (!process->started) {
+    process->started = true;
+    process->startTime = currentTime;
+  }
+  if (process->cpu != -1 && process->cpu != cpu)
+    ++stats[cpu].migrations;
+  process->cpu = cpu;
+  if (execIndex != cpus[cpu].previous)
+    ++stats[cpu].dispatches;
 #ifdef DEBUG
-    printf("%s preempted with %d time left\n", processes[execIndex].name,
-           processes[execIndex].execTime);
+  printf("%d: P%d dispatched on cpu %d\n", currentTime, execIndex + 1, cpu);
 #endif
+}
+
+// moves queued processes from the most to the least loaded cpu until their
+// loads differ by at most one
+void BalanceQueues(const Process* processes, RunQueue* queues,
+                   const Cpu* cpus, int m) {
+  while (true) {
+    int busiest = -1, idlest = 0;
+    int maxLoad = 0, minLoad = INT_MAX;
+    for (int c = 0; c < m; ++c) {
+      int load = RunQueueSize(&queues[c]) + (cpus[c].running != -1);
+      if (RunQueueSize(&queues[c]) > 0 && load > maxLoad) {
+        busiest = c;
+        maxLoad = load;
+      }
+      if (load < minLoad) {
+        idlest = c;
+        minLoad = load;
+      }
     }
+    if (busiest == -1 || maxLoad - minLoad <= 1)
+      break;
+    int stolen = RunQueueSteal(&queues[busiest]);
+    RunQueuePush(&queues[idlest], stolen, processes[stolen].execTime);
   }
 }
-
@@ -0,0 +1,360 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Reads the text workload format:
+//   <policy>
+//   <number of processes>
+//   <name> <ready time> <execution time> [<deadline> [<weight>]]
+//   ...
+// The optional deadline is the time by which the process should finish;
+// processes without one get WORKLOAD_NO_DEADLINE. The optional weight is
+// the process's share of the cpu relative to the others, 1 by default. An
+// optional column can be skipped with "-" to give a later one.
+// If the input is a regular file it is memory-mapped and scanned in place;
+// otherwise (pipes, terminals) it is read in fixed-size chunks.
+//
+// Workloads can also be stored in a binary format produced by pack, which
+// is used in place from the mapping without any parsing:
+//   WorkloadHeader
+//   WorkloadRecord[count], sorted by ready time, then by input order
+//   int32_t[count] for each optional column set in columns, in the order
+//     of their bits
+//   char[nameCount][WORKLOAD_NAME_SIZE], the interned process names
+// All fields are in host byte order. Binary workloads must be regular files.
+
+#define READER_CHUNK_SIZE (1 << 16)
+// long enough to hold any token we accept, so a token is never split across
+// two chunks once this many bytes are buffered
+#define READER_LOOKAHEAD 64
+
+#define WORKLOAD_MAGIC "SCHEDWL"
+#define WORKLOAD_VERSION 1
+#define WORKLOAD_NAME_SIZE 32
+#define WORKLOAD_POLICY_SIZE 8
+#define WORKLOAD_NO_DEADLINE INT32_MAX
+#define WORKLOAD_DEFAULT_WEIGHT 1
+// optional columns of the binary format
+#define WORKLOAD_COLUMN_DEADLINE (1u << 0)
+#define WORKLOAD_COLUMN_WEIGHT (1u << 1)
+#define WORKLOAD_COLUMNS (WORKLOAD_COLUMN_DEADLINE | WORKLOAD_COLUMN_WEIGHT)
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  char policy[WORKLOAD_POLICY_SIZE];
+  uint32_t count;
+  uint32_t nameCount;
+  uint32_t columns;
+  uint64_t namesOffset;
+} WorkloadHeader;
+
+typedef struct {
+  int32_t readyTime;
+  int32_t execTime;
+  uint32_t nameId;
+} WorkloadRecord;
+
+typedef struct {
+  const WorkloadHeader* header;
+  const WorkloadRecord* records;
+  // NULL if the workload has no deadlines or weights
+  const int32_t* deadlines;
+  const int32_t* weights;
+  const char (*names)[WORKLOAD_NAME_SIZE];
+} BinaryWorkload;
+
+typedef struct {
+  const char* data;
+  size_t pos;
+  size_t end;
+  bool eof;
+  // set if data points into a mapping of the whole file
+  bool mapped;
+  size_t mappedSize;
+  // used by the chunked fallback only
+  int fd;
+  char* buffer;
+} Reader;
+
+// a process of a workload in either format, as given to the drivers
+typedef struct {
+  char name[WORKLOAD_NAME_SIZE];
+  int readyTime;
+  int execTime;
+  int deadline;
+  int weight;
+  // position in the input
+  int index;
+} WorkloadJob;
+
+typedef struct {
+  Reader* reader;
+  char policy[WORKLOAD_POLICY_SIZE];
+  int count;
+  // index of the next job to be read
+  int next;
+  // jobs come from mapped, already sorted, rather than being parsed
+  bool binary;
+  BinaryWorkload mapped;
+  // why the workload was rejected
+  const char* error;
+} Workload;
+
+
+static inline bool ReaderOpen(Reader* reader, int fd) {
+  memset(reader, 0, sizeof(Reader));
+  reader->fd = fd;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (offset < 0) offset = 0;
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      reader->data = data;
+      reader->pos = offset;
+      reader->end = reader->mappedSize = st.st_size;
+      reader->eof = reader->mapped = true;
+      return true;
+    }
+  }
+  reader->buffer = malloc(READER_CHUNK_SIZE);
+  if (!reader->buffer) return false;
+  reader->data = reader->buffer;
+  return true;
+}
+
+static inline void ReaderClose(Reader* reader) {
+  if (reader->mapped)
+    munmap((void*)reader->data, reader->mappedSize);
+  else
+    free(reader->buffer);
+}
+
+// makes sure at least READER_LOOKAHEAD bytes are buffered unless the input
+// is exhausted
+static inline bool ReaderFill(Reader* reader) {
+  while (!reader->eof && reader->end - reader->pos < READER_LOOKAHEAD) {
+    size_t remaining = reader->end - reader->pos;
+    memmove(reader->buffer, reader->buffer + reader->pos, remaining);
+    reader->pos = 0;
+    reader->end = remaining;
+    ssize_t bytes = read(reader->fd, reader->buffer + reader->end,
+                         READER_CHUNK_SIZE - reader->end);
+    if (bytes < 0) return false;
+    if (bytes == 0) reader->eof = true;
+    reader->end += bytes;
+  }
+  return true;
+}
+
+static inline bool IsSpace(char c) {
+  return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+// skips whitespace and returns false if the input ends before a token
+static inline bool ReaderSkipSpace(Reader* reader) {
+  while (true) {
+    while (reader->pos < reader->end && IsSpace(reader->data[reader->pos]))
+      ++reader->pos;
+    if (reader->pos < reader->end || reader->eof) break;
+    if (!ReaderFill(reader)) return false;
+  }
+  if (!ReaderFill(reader)) return false;
+  return reader->pos < reader->end;
+}
+
+// reads a whitespace-delimited token into buf (of size n including the
+// terminating null byte); fails if the token does not fit
+static inline bool ReadToken(Reader* reader, char* buf, size_t n) {
+  if (!ReaderSkipSpace(reader)) return false;
+  const char* p = reader->data + reader->pos;
+  const char* end = reader->data + reader->end;
+  size_t len = 0;
+  while (p + len < end && !IsSpace(p[len]))
+    ++len;
+  if (len >= n) return false;
+  memcpy(buf, p, len);
+  buf[len] = '\0';
+  reader->pos += len;
+  return true;
+}
+
+// reads an optionally signed decimal integer that fits in an int
+static inline bool ReadInt(Reader* reader, int* value) {
+  if (!ReaderSkipSpace(reader)) return false;
+  const char* p = reader->data + reader->pos;
+  const char* end = reader->data + reader->end;
+  bool negative = *p == '-';
+  p += negative | (*p == '+');
+  const char* digits = p;
+  long long result = 0;
+  unsigned digit;
+  while (p < end && (digit = (unsigned char)*p - '0') < 10 &&
+         p - digits < 11) {
+    result = result * 10 + digit;
+    ++p;
+  }
+  if (p == digits || (p < end && !IsSpace(*p))) return false;
+  result = negative ? -result : result;
+  if (result < -2147483648LL || result > 2147483647LL) return false;
+  *value = (int)result;
+  reader->pos = p - reader->data;
+  return true;
+}
+
+// reads an integer if there is one before the end of the line, leaving
+// value unchanged otherwise or if it is given as "-"
+static inline bool ReadOptionalInt(Reader* reader, int* value) {
+  while (true) {
+    while (reader->pos < reader->end && (reader->data[reader->pos] == ' ' ||
+                                         reader->data[reader->pos] == '\t'))
+      ++reader->pos;
+    if (reader->pos < reader->end || reader->eof) break;
+    if (!ReaderFill(reader)) return false;
+  }
+  if (!ReaderFill(reader)) return false;
+  const char* p = reader->data + reader->pos;
+  size_t left = reader->end - reader->pos;
+  if (left == 0 || *p == '\n' || *p == '\r')
+    return true;
+  if (*p == '-' && (left == 1 || IsSpace(p[1]))) {
+    ++reader->pos;
+    return true;
+  }
+  return ReadInt(reader, value);
+}
+
+// returns true if the input starts with the binary workload magic
+static inline bool ReaderIsBinary(Reader* reader) {
+  if (!ReaderFill(reader)) return false;
+  return reader->end - reader->pos >= sizeof(WORKLOAD_MAGIC) &&
+         memcmp(reader->data + reader->pos, WORKLOAD_MAGIC,
+                sizeof(WORKLOAD_MAGIC)) == 0;
+}
+
+// validates a mapped binary workload and points workload into the mapping;
+// the reader must stay open while workload is in use
+static inline bool BinaryWorkloadOpen(const Reader* reader,
+                                      BinaryWorkload* workload) {
+  if (!reader->mapped) return false;
+  const char* base = reader->data + reader->pos;
+  size_t size = reader->end - reader->pos;
+  const WorkloadHeader* header = (const WorkloadHeader*)base;
+  if (size < sizeof(WorkloadHeader) ||
+      (uintptr_t)base % sizeof(uint64_t) != 0 ||
+      memcmp(header->magic, WORKLOAD_MAGIC, sizeof(WORKLOAD_MAGIC)) != 0 ||
+      header->version != WORKLOAD_VERSION ||
+      memchr(header->policy, '\0', sizeof(header->policy)) == NULL ||
+      header->count == 0 || header->count > INT32_MAX ||
+      (header->columns & ~WORKLOAD_COLUMNS) != 0 ||
+      sizeof(WorkloadHeader) + (uint64_t)header->count *
+        (sizeof(WorkloadRecord) + sizeof(int32_t) *
+         __builtin_popcount(header->columns)) > header->namesOffset ||
+      header->namesOffset % sizeof(uint32_t) != 0 ||
+      header->namesOffset > size ||
+      (size - header->namesOffset) / WORKLOAD_NAME_SIZE < header->nameCount)
+    return false;
+  workload->header = header;
+  workload->records = (const WorkloadRecord*)(header + 1);
+  const int32_t* column = (const int32_t*)(workload->records + header->count);
+  workload->deadlines = workload->weights = NULL;
+  if (header->columns & WORKLOAD_COLUMN_DEADLINE) {
+    workload->deadlines = column;
+    column += header->count;
+  }
+  if (header->columns & WORKLOAD_COLUMN_WEIGHT)
+    workload->weights = column;
+  workload->names = (const char (*)[WORKLOAD_NAME_SIZE])
+                    (base + header->namesOffset);
+  for (uint32_t i = 0; i < header->count; ++i) {
+    const WorkloadRecord* record = &workload->records[i];
+    if (record->nameId >= header->nameCount ||
+        workload->names[record->nameId][WORKLOAD_NAME_SIZE - 1] != '\0' ||
+        (i > 0 && record->readyTime < record[-1].readyTime) ||
+        (workload->weights && workload->weights[i] < 1))
+      return false;
+  }
+  return true;
+}
+
+// orders jobs by ready time, then by input order, without the overflow of
+// subtracting ready times far apart
+static inline int WorkloadOrder(int readyTime, int index, int otherReadyTime,
+                                int otherIndex) {
+  if (readyTime != otherReadyTime)
+    return readyTime < otherReadyTime ? -1 : 1;
+  return index < otherIndex ? -1 : index > otherIndex;
+}
+
+// Starts reading a workload in either format, whose jobs are then taken one
+// at a time with WorkloadNext: a binary workload straight from its mapping,
+// a text one as it is parsed. The reader must stay open until the last job
+// has been read. Returns false with workload->error set if the workload is
+// invalid.
+static inline bool WorkloadOpen(Reader* reader, Workload* workload) {
+  workload->reader = reader;
+  workload->next = 0;
+  workload->binary = ReaderIsBinary(reader);
+  if (workload->binary) {
+    if (!reader->mapped) {
+      workload->error = "binary workloads must be read from a regular file";
+      return false;
+    }
+    if (!BinaryWorkloadOpen(reader, &workload->mapped)) {
+      workload->error = "invalid binary workload";
+      return false;
+    }
+    strcpy(workload->policy, workload->mapped.header->policy);
+    workload->count = workload->mapped.header->count;
+    return true;
+  }
+  if (!ReadToken(reader, workload->policy, sizeof(workload->policy)) ||
+      !ReadInt(reader, &workload->count) || workload->count <= 0) {
+    workload->error = "invalid policy or number of processes";
+    return false;
+  }
+  return true;
+}
+
+// reads the next of workload->count jobs; returns false with
+// workload->error set if it is invalid
+static inline bool WorkloadNext(Workload* workload, WorkloadJob* job) {
+  int i = workload->next++;
+  job->index = i;
+  if (workload->binary) {
+    const BinaryWorkload* mapped = &workload->mapped;
+    const WorkloadRecord* record = &mapped->records[i];
+    memcpy(job->name, mapped->names[record->nameId], sizeof(job->name));
+    job->readyTime = record->readyTime;
+    job->execTime = record->execTime;
+    job->deadline = mapped->deadlines ? mapped->deadlines[i] :
+                                        WORKLOAD_NO_DEADLINE;
+    job->weight = mapped->weights ? mapped->weights[i] :
+                                    WORKLOAD_DEFAULT_WEIGHT;
+    return true;
+  }
+  job->deadline = WORKLOAD_NO_DEADLINE;
+  job->weight = WORKLOAD_DEFAULT_WEIGHT;
+  if (!ReadToken(workload->reader, job->name, sizeof(job->name)) ||
+      !ReadInt(workload->reader, &job->readyTime) ||
+      !ReadInt(workload->reader, &job->execTime) ||
+      !ReadOptionalInt(workload->reader, &job->deadline) ||
+      !ReadOptionalInt(workload->reader, &job->weight) ||
+      job->weight < 1) {
+    workload->error = "invalid process";
+    return false;
+  }
+  return true;
+}
+
+#endif